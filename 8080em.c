@@ -1,2106 +1,3723 @@
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-typedef struct ConditionCodes {
-  uint8_t z : 1;
-  uint8_t s : 1;
-  uint8_t p : 1;
-  uint8_t cy : 1;
-  uint8_t ac : 1;
-  uint8_t pad : 3;
-} ConditionCodes;
+#include <pthread.h>
+#include <stdatomic.h>
 
+#include "opcodes8080.h"
+#include "video8080.h"
+#ifdef JIT
+#include <stdarg.h>
+#include <sys/mman.h>
+#endif
+
+// An instruction as predecoded by decode8080()
+typedef struct Decoded8080 {
+#ifdef THREADED_DISPATCH
+  const void *handler; // label of the opcode body
+#endif
+  uint16_t imm;   // operand bytes, low byte first
+#ifdef SUPERINSTRUCTIONS
+  uint16_t key;   // opcode, or the FUSE_* key running it with the next one
+#endif
+  uint8_t opcode;
+  uint8_t len;
+  uint8_t cycles; // base cost from cycles8080
+} Decoded8080;
+
+#ifdef SUPERINSTRUCTIONS
+#define DISPATCH_KEY(d) ((d)->key)
+#else
+#define DISPATCH_KEY(d) ((d)->opcode)
+#endif
+
+// A straight-line run of predecoded instructions ending at the first jump,
+// call, return, RST, PCHL or HLT. Blocks are cached by entry pc and remember
+// up to two successors so a following block is found without a lookup.
+#define BLOCK_MAX_INSTS 32
+#define BLOCK_POOL_SIZE 4096
+typedef struct Block8080 {
+  uint16_t start;
+  uint16_t end; // address after the last instruction
+  uint8_t count;
+  uint8_t valid; // cleared when guest code writes over the block
+  uint8_t idle;  // tries left at catching it idling, see idle_loop()
+  struct Block8080 *next[2];
+  struct Block8080 *page_next; // other blocks starting in the same page
+#ifdef SUPERINSTRUCTIONS
+  uint32_t runs; // times entered, for fusion_report()
+#endif
+#ifdef JIT
+  void *native;  // compiled code, see jit_block()
+  uint8_t hits;  // entries while not compiled, 0xff if it cannot be
+#endif
+  Decoded8080 insts[BLOCK_MAX_INSTS];
+} Block8080;
+
+typedef struct BlockCache8080 {
+  Block8080 *map[0x10000];    // by entry pc
+  Block8080 *pages[256];      // by page of the entry pc
+  Block8080 pool[BLOCK_POOL_SIZE];
+  int used;
+} BlockCache8080;
+
+#ifdef JIT
+// Executable buffer of the dynamic recompiler, emptied together with the
+// block cache since compiled code hangs off the blocks
+#define JIT_THRESHOLD 16 // block entries before it is compiled
+#define JIT_BUFFER_SIZE (8 << 20)
+typedef struct Jit8080 {
+  uint8_t *code;
+  size_t used;
+  int threshold;
+  int compiled;   // blocks translated so far
+  int dead_flags; // flag updates they leave out, see jit_live_flags()
+  // Block entries jit_block() was asked about and those that ran natively,
+  // for jit_report()
+  uint64_t entries, native;
+} Jit8080;
+#endif
+
+// Handlers of a memory-mapped device, see map_mmio(). They get the address
+// the CPU used, after any mirroring.
+struct State8080;
+typedef struct Mmio8080 {
+  uint8_t (*read)(struct State8080 *state, uint16_t addr);
+  void (*write)(struct State8080 *state, uint16_t addr, uint8_t value);
+} Mmio8080;
+#define MMIO_SLOTS 8
+
+// What each 256-byte page of the address space needs besides a plain load
+// or store of state->memory. Pages with no bits are RAM.
+#define PAGE_CODE 0x01   // the block cache holds code from it
+#define PAGE_TAIL 0x02   // page 0, copied past the end of memory
+#define PAGE_ROM 0x04    // stores are dropped
+#define PAGE_MMIO 0x08   // a device, page_map gives its mmio slot
+#define PAGE_MIRROR 0x10 // page_map gives the page it stands for
+#define PAGE_ALIASED 0x20 // code was fetched through a mirror of it
+#define PAGE_VIDEO 0x40   // stores that change it mark video_dirty
+#define PAGE_READ_SLOW (PAGE_MMIO | PAGE_MIRROR)
+
+// What IN and OUT on one port reach, see attach_in() and attach_out().
+// Ports with nothing attached read 0 and drop what is written.
+typedef struct Port8080 {
+  uint8_t (*in)(void *device, uint8_t port);
+  void (*out)(void *device, uint8_t port, uint8_t value);
+  void *in_device;
+  void *out_device;
+} Port8080;
+
+// Something due at an emulated cycle, see schedule(). `fire` gets the cycle
+// it was due at, which can be earlier than the clock since run_until()
+// only stops between blocks.
+#define EVENTS_MAX 16
+typedef struct Event8080 {
+  uint64_t when;
+  void (*fire)(struct State8080 *state, void *device, uint64_t when);
+  void *device;
+} Event8080;
+
+// Pending events as a binary min-heap on `when`, and the clock they are
+// measured against: cycles run through run_until() since reset
+typedef struct Events8080 {
+  uint64_t now;
+  Event8080 heap[EVENTS_MAX];
+  int count;
+} Events8080;
+
+// Register pairs share storage with their halves, so BC, DE and HL are
+// read and written as one 16-bit value. The high register has to be the
+// high byte of the pair whatever the host byte order.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REG_PAIR(hi, lo)                                                       \
+  union {                                                                      \
+    struct {                                                                   \
+      uint8_t hi, lo;                                                          \
+    };                                                                         \
+    uint16_t hi##lo;                                                           \
+  }
+#else
+#define REG_PAIR(hi, lo)                                                       \
+  union {                                                                      \
+    struct {                                                                   \
+      uint8_t lo, hi;                                                          \
+    };                                                                         \
+    uint16_t hi##lo;                                                           \
+  }
+#endif
+
+// Flag bits kept in State8080.f, the PSW byte minus its constant bits
+#define FLAGS_PSW (FLAG_S | FLAG_Z | FLAG_AC | FLAG_P | FLAG_CY)
+
+// The fields every instruction touches come first and fill one 64-byte
+// cache line, the rest follow in later lines. Heap copies need
+// aligned_alloc() to keep the alignment.
 typedef struct State8080 {
+  _Alignas(64) REG_PAIR(b, c);
+  REG_PAIR(d, e);
+  REG_PAIR(h, l);
   uint8_t a;
-  uint8_t b;
-  uint8_t c;
-  uint8_t d;
-  uint8_t e;
-  uint8_t h;
-  uint8_t l;
+  uint8_t f; // FLAG_* bits
   uint16_t sp;
   uint16_t pc;
+#ifdef LAZY_FLAGS
+  // Last result that set Z/S/P/AC, and the operands XOR result whose bit 4
+  // is the aux carry. Those bits of f are stale while flags_pending is set,
+  // call sync_flags() before reading them.
+  uint8_t flag_res;
+  uint8_t flag_aux;
+  uint8_t flags_pending;
+#endif
   uint8_t *memory;
-  struct ConditionCodes cc;
+  // Block cache, allocated on first run
+  BlockCache8080 *blocks;
+#ifdef STATIC_ROM
+  // Size of the ROM STATIC_ROM was generated from while memory holds it
+  // unchanged, 0 when the translated blocks must not run
+  uint32_t static_rom;
+#endif
+#ifdef JIT
+  Jit8080 *jit; // NULL unless jit_enable() was called
+#endif
+  // PAGE_* bits of each page, any of them sends stores through
+  // write_mem()'s slow path. Hosts changing code behind the CPU's back
+  // must call invalidate_code().
+  _Alignas(64) uint8_t pages[256];
+  uint8_t page_map[256];
+  const Mmio8080 *mmio[MMIO_SLOTS];
+  Port8080 ports[256];
+  Events8080 events;
   uint8_t int_enable;
+  uint8_t halted; // parked on a HLT, an interrupt resumes after it
+  uint64_t idle_skipped; // cycles HLT and wait loops were fast-forwarded by
+  uint32_t mmio_reads;   // loads devices answered, see IDLE_SPAN
+  // Lines of the PAGE_VIDEO pages from video_start changed since the last
+  // take_video_dirty()
+  uint16_t video_start;
+  VideoDirty video_dirty;
 } State8080;
 
-void unimplementedInst(State8080 *state) {
-  printf("Error: Unimplemented Instruction\n");
-  exit(1);
+_Static_assert(offsetof(State8080, pages) == 64,
+               "hot State8080 fields must fit one cache line");
+
+// 2 MHz clock, the screen refreshes at 60 Hz and interrupts twice a frame
+#define CPU_CLOCK_HZ 2000000
+#define CYCLES_PER_FRAME (CPU_CLOCK_HZ / 60)
+#define CYCLES_PER_HALF_FRAME ((CYCLES_PER_FRAME + 1) / 2)
+
+// Guest memory is the 64K address space followed by a copy of its first
+// MEMORY_TAIL bytes, so operands and 16-bit loads at the top of memory read
+// straight through the end instead of wrapping their address. Allocate it
+// with alloc_memory() and hand it over with attach_memory(), then lay out
+// ROM, mirrors and devices with map_rom(), map_mirror() and map_mmio().
+#define MEMORY_SIZE 0x10000
+#define MEMORY_TAIL 16
+
+static inline uint16_t read16(const uint8_t *p) {
+  // Little-endian word at `p`, one unaligned load
+  uint16_t value;
+  memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap16(value);
+#endif
+  return value;
+}
+
+static uint16_t unmirror(State8080 *state, uint16_t addr) {
+  // The address a PAGE_MIRROR page stands for
+  return state->page_map[addr >> 8] << 8 | (addr & 0xff);
 }
 
-int Parity(int x, int size) {
-  int p = 0;
-  x = (x & ((1 << size) - 1));
-  for (int i = 0; i < size; i++) {
-    if (x & 0x1)
-      p++;
-    x = x >> 1;
+static uint8_t read_slow(State8080 *state, uint16_t addr) {
+  // read_mem() for device and mirror pages
+  if (state->pages[addr >> 8] & PAGE_MIRROR)
+    addr = unmirror(state, addr);
+  if (state->pages[addr >> 8] & PAGE_MMIO) {
+    state->mmio_reads++;
+    return state->mmio[state->page_map[addr >> 8]]->read(state, addr);
   }
-  return (0 == (p & 0x1));
+  return state->memory[addr];
 }
 
-int Emulate8080p(State8080 *state) {
-  unsigned char *opcode = &state->memory[state->pc];
-  switch (*opcode) {
-  case 0x00: // NOP
-    break;
-  case 0x01: // LXI    B, word
-  {
-    state->c = opcode[1];
-    state->b = opcode[2];
-    state->pc += 2; // advance Program Counter by 2 bytes
-  } break;
-  case 0x02: // STAX  B
-  {
-    state->a = state->c;
-    state->a = state->b;
-    state->pc++;
-  } break;
-  case 0x03: // INX  B
-  {
-    uint16_t bc = (state->b << 8) | (state->c);
-    bc++;
-    state->b = (bc & 0xff00) >> 8;
-    state->c = bc & 0xff;
-  } break;
-  case 0x04: // INR  B
-  {
-    uint8_t answer = state->b + 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->b = answer;
-  } break;
-  case 0x05: // DCR B
-  {
-    uint8_t answer = state->b - 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->b = answer;
-  } break;
-  case 0x06: // MVI  B, D8
-  {
-    state->b = opcode[1];
-    state->pc++;
-  } break;
-  case 0x07: // RLC
-  {
-    uint16_t ac = (uint16_t)state->a;
-    ac = ac << 1;
-    uint16_t carry = (ac & 0x100);
-    if (carry) {
-      ac = 0x100 + ac;
-      ac = ac & 0xff;
-      ac++;
-    } else {
-      ac = 0x100 + ac;
-      ac = ac & 0xff;
-    }
-  } break;
-  case 0x08:
-    break;
-  case 0x09: // DAD  B
-  {
-    uint32_t hl = (state->h << 8) | state->l;
-    uint32_t bc = (state->b << 8) | state->c;
-    uint32_t res = hl + bc;
-    state->h = (res & 0xff00) >> 8;
-    state->l = res & 0xff;
-    state->cc.cy = ((res & 0xffff0000) > 0);
-  } break;
-  case 0x0a: // LDAX B
-  {
-    state->a = state->c;
-    state->a = state->b;
-    state->pc++;
-  } break;
-  case 0x0b: // DCX  B
-  {
-    uint16_t bc = (state->b << 8) | (state->c);
-    bc--;
-    state->b = (bc & 0xff00) >> 8;
-    state->c = bc & 0xff;
-  } break;
-  case 0x0c: // INR  C
-  {
-    uint8_t answer = state->c + 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->c = answer;
-  } break;
-  case 0x0d: // DCR  C
-  {
-    uint8_t answer = state->c - 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->c = answer;
-  } break;
-  case 0x0e:
-    unimplementedInst(state);
-    break;
-  case 0x0f:
-    unimplementedInst(state);
-    break;
-  case 0x10:
-    unimplementedInst(state);
-    break;
-  case 0x11:
-    unimplementedInst(state);
-    break;
+static inline uint8_t read_mem(State8080 *state, uint16_t addr) {
+  if (state->pages[addr >> 8] & PAGE_READ_SLOW)
+    return read_slow(state, addr);
+  return state->memory[addr];
+}
+
+static inline uint16_t read_mem16(State8080 *state, uint16_t addr) {
+  // Little-endian word at `addr`, wrapping at the top of memory
+  if ((state->pages[addr >> 8] | state->pages[(uint16_t)(addr + 1) >> 8]) &
+      PAGE_READ_SLOW)
+    return read_slow(state, addr) |
+           read_slow(state, (uint16_t)(addr + 1)) << 8;
+  return read16(state->memory + addr);
+}
+
+static void mark_code(State8080 *state, uint16_t addr) {
+  // Notes that the block cache holds code fetched from `addr`. Through a
+  // mirror, stores into the page it stands for must find those blocks too.
+  uint8_t page = addr >> 8;
+  state->pages[page] |= PAGE_CODE;
+  if (state->pages[page] & PAGE_MIRROR)
+    state->pages[state->page_map[page]] |= PAGE_ALIASED;
+}
+
+// Which bytes after the opcode are operand, by instruction length
+static const uint16_t imm_mask[4] = {0, 0, 0x00ff, 0xffff};
+
+void decode8080(State8080 *state, Decoded8080 *d, uint16_t addr) {
+  // Fills in the predecoded form of the instruction at `addr`
+  uint16_t last = addr + 2;
+  uint8_t op;
+  uint16_t imm;
+  if ((state->pages[addr >> 8] | state->pages[last >> 8]) & PAGE_READ_SLOW) {
+    // Only the bytes the instruction has, devices may count reads
+    op = read_mem(state, addr);
+    imm = 0;
+    for (int i = length8080[op] - 1; i > 0; i--)
+      imm = imm << 8 | read_mem(state, (uint16_t)(addr + i));
+  } else {
+    const uint8_t *p = state->memory + addr;
+    op = p[0];
+    imm = read16(p + 1) & imm_mask[length8080[op]];
+  }
+  d->opcode = op;
+  d->len = length8080[op];
+  d->cycles = cycles8080[op];
+  d->imm = imm;
+  mark_code(state, addr);
+  mark_code(state, (uint16_t)(addr + d->len - 1));
+}
+
+static int side_effects(uint8_t op) {
+  // Whether `op` does more than read memory and change registers: stores,
+  // stack traffic, I/O, interrupt state, HLT. Block enders other than
+  // jumps never get asked.
+  switch (op) {
+  case 0x02: // STAX
   case 0x12:
-    unimplementedInst(state);
-    break;
-  case 0x13: // INX  D
-  {
-    uint16_t de = (state->d << 8) | (state->e);
-    de++;
-    state->d = (de & 0xff00) >> 8;
-    state->e = de & 0xff;
-  } break;
-  case 0x14: // INR  D
-  {
-    uint8_t answer = state->d + 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->d = answer;
-  } break;
-  case 0x15: // DCR  D
-  {
-    uint8_t answer = state->d - 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->d = answer;
-  } break;
-  case 0x16:
-    unimplementedInst(state);
-    break;
-  case 0x17:
-    unimplementedInst(state);
-    break;
-  case 0x18:
-    unimplementedInst(state);
-    break;
-  case 0x19:
-    unimplementedInst(state);
-    break;
-  case 0x1a:
-    unimplementedInst(state);
-    break;
-  case 0x1b:
-    unimplementedInst(state);
-    break;
-  case 0x1c: // INR E
-  {
-    uint8_t answer = state->e + 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->e = answer;
-  } break;
-  case 0x1d: // DCR  E
-  {
-    uint8_t answer = state->e - 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->e = answer;
-  } break;
-  case 0x1e:
-    unimplementedInst(state);
-    break;
-  case 0x1f:
-    unimplementedInst(state);
-    break;
-  case 0x20:
-    unimplementedInst(state);
-    break;
-  case 0x21:
-    unimplementedInst(state);
-    break;
-  case 0x22:
-    unimplementedInst(state);
-    break;
-  case 0x23: // INX  H
-  {
-    uint16_t hl = (state->h << 8) | (state->l);
-    hl++;
-    state->h = (hl & 0xff00) >> 8;
-    state->l = hl & 0xff;
-  } break;
-  case 0x24: // INR  H
-  {
-    uint8_t answer = state->h + 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->h = answer;
-  } break;
-  case 0x25: // DCR  H
-  {
-    uint8_t answer = state->h - 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->h = answer;
-  } break;
-  case 0x26:
-    unimplementedInst(state);
-    break;
-  case 0x27:
-    unimplementedInst(state);
-    break;
-  case 0x28:
-    unimplementedInst(state);
-    break;
-  case 0x29:
-    unimplementedInst(state);
-    break;
-  case 0x2a:
-    unimplementedInst(state);
-    break;
-  case 0x2b:
-    unimplementedInst(state);
-    break;
-  case 0x2c: // INR  L
-  {
-    uint8_t answer = state->l + 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->l = answer;
-  } break;
-  case 0x2d: // DCR  L
-  {
-    uint8_t answer = state->l - 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->l = answer;
-  } break;
-  case 0x2e:
-    unimplementedInst(state);
-    break;
-  case 0x2f:
-    unimplementedInst(state);
-    break;
-  case 0x30:
-    unimplementedInst(state);
-    break;
-  case 0x31:
-    unimplementedInst(state);
-    break;
-  case 0x32:
-    unimplementedInst(state);
-    break;
-  case 0x33: // INX  SP
-    state->sp++;
-    break;
-  case 0x34: // INR  M
-  {
-    uint16_t offset = (state->h << 8) | (state->l);
-    uint16_t answer = state->memory[offset];
-    answer++;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->memory[offset] = answer;
-  } break;
-  case 0x35: // DCR  M
-  {
-    uint16_t offset = (state->h << 8) | (state->l);
-    uint16_t answer = state->memory[offset];
-    answer--;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->memory[offset] = answer;
-  } break;
-  case 0x36: // MVI  M, byte
-  {
-    // AC set if lower nibble of h was zero prior to dec
-    uint16_t offset = (state->h << 8) | state->l;
-    state->memory[offset] = opcode[1];
-    state->pc++;
-  } break;
-  case 0x37:
-    unimplementedInst(state);
-    break;
-  case 0x38:
-    unimplementedInst(state);
-    break;
-  case 0x39:
-    unimplementedInst(state);
-    break;
-  case 0x3a:
-    unimplementedInst(state);
-    break;
-  case 0x3b:
-    unimplementedInst(state);
-    break;
-  case 0x3c: // INR A
-  {
-    uint8_t answer = state->a + 1;
-    state->cc.z = (answer == 0);
-    state->cc.s = (0x80 == (answer & 0x80));
-    state->cc.ac = (answer > 0xf);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer;
-  } break;
-  case 0x3d:
-    unimplementedInst(state);
-    break;
-  case 0x3e:
-    unimplementedInst(state);
-    break;
-  case 0x3f:
-    unimplementedInst(state);
-    break;
-  case 0x40:
-    unimplementedInst(state);
-    break;
-  case 0x41:
-    unimplementedInst(state);
-    break;
-  case 0x42:
-    unimplementedInst(state);
-    break;
-  case 0x43:
-    unimplementedInst(state);
-    break;
-  case 0x44:
-    unimplementedInst(state);
-    break;
-  case 0x45:
-    unimplementedInst(state);
-    break;
-  case 0x46:
-    unimplementedInst(state);
-    break;
-  case 0x47:
-    unimplementedInst(state);
-    break;
-  case 0x48:
-    unimplementedInst(state);
-    break;
-  case 0x49:
-    unimplementedInst(state);
-    break;
-  case 0x4a:
-    unimplementedInst(state);
-    break;
-  case 0x4b:
-    unimplementedInst(state);
-    break;
-  case 0x4c:
-    unimplementedInst(state);
-    break;
-  case 0x4d:
-    unimplementedInst(state);
-    break;
-  case 0x4e:
-    unimplementedInst(state);
-    break;
-  case 0x4f:
-    unimplementedInst(state);
-    break;
-  case 0x50:
-    unimplementedInst(state);
-    break;
-  case 0x51:
-    unimplementedInst(state);
-    break;
-  case 0x52:
-    unimplementedInst(state);
-    break;
-  case 0x53:
-    unimplementedInst(state);
-    break;
-  case 0x54:
-    unimplementedInst(state);
-    break;
-  case 0x55:
-    unimplementedInst(state);
-    break;
-  case 0x56:
-    unimplementedInst(state);
-    break;
-  case 0x57:
-    unimplementedInst(state);
-    break;
-  case 0x58:
-    unimplementedInst(state);
-    break;
-  case 0x59:
-    unimplementedInst(state);
-    break;
-  case 0x5a:
-    unimplementedInst(state);
-    break;
-  case 0x5b:
-    unimplementedInst(state);
-    break;
-  case 0x5c:
-    unimplementedInst(state);
-    break;
-  case 0x5d:
-    unimplementedInst(state);
-    break;
-  case 0x5e:
-    unimplementedInst(state);
-    break;
-  case 0x5f:
-    unimplementedInst(state);
-    break;
-  case 0x60:
-    unimplementedInst(state);
-    break;
-  case 0x61:
-    unimplementedInst(state);
-    break;
-  case 0x62:
-    unimplementedInst(state);
-    break;
-  case 0x63:
-    unimplementedInst(state);
-    break;
-  case 0x64:
-    unimplementedInst(state);
-    break;
-  case 0x65:
-    unimplementedInst(state);
-    break;
-  case 0x66:
-    unimplementedInst(state);
-    break;
-  case 0x67:
-    unimplementedInst(state);
-    break;
-  case 0x68:
-    unimplementedInst(state);
-    break;
-  case 0x69:
-    unimplementedInst(state);
-    break;
-  case 0x6a:
-    unimplementedInst(state);
-    break;
-  case 0x6b:
-    unimplementedInst(state);
-    break;
-  case 0x6c:
-    unimplementedInst(state);
-    break;
-  case 0x6d:
-    unimplementedInst(state);
-    break;
-  case 0x6e:
-    unimplementedInst(state);
-    break;
-  case 0x6f:
-    unimplementedInst(state);
-    break;
-  case 0x70:
-    unimplementedInst(state);
-    break;
-  case 0x71:
-    unimplementedInst(state);
-    break;
-  case 0x72:
-    unimplementedInst(state);
-    break;
-  case 0x73:
-    unimplementedInst(state);
-    break;
-  case 0x74:
-    unimplementedInst(state);
-    break;
-  case 0x75:
-    unimplementedInst(state);
-    break;
-  case 0x76:
-    unimplementedInst(state);
-    break;
-  case 0x77:
-    unimplementedInst(state);
-    break;
-  case 0x78:
-    unimplementedInst(state);
-    break;
-  case 0x79:
-    unimplementedInst(state);
-    break;
-  case 0x7a:
-    unimplementedInst(state);
-    break;
-  case 0x7b:
-    unimplementedInst(state);
-    break;
-  case 0x7c:
-    unimplementedInst(state);
-    break;
-  case 0x7d:
-    unimplementedInst(state);
-    break;
-  case 0x7e:
-    unimplementedInst(state);
-    break;
-  case 0x7f:
-    unimplementedInst(state);
-    break;
-  case 0x80: // ADD    B
-  {
-    // performing operation at higher precision to capture the carry
-    uint16_t answer = (uint16_t)state->a + (uint16_t)state->b;
-
-    // Zero Flag
-    if ((answer & 0xff) == 0)
-      state->cc.z = 1;
-    else
-      state->cc.z = 0;
+  case 0x22: // SHLD
+  case 0x32: // STA
+  case 0x34: // INR M
+  case 0x35: // DCR M
+  case 0x36: // MVI M
+  case 0x76: // HLT
+  case 0xd3: // OUT
+  case 0xdb: // IN
+  case 0xe3: // XTHL
+  case 0xf3: // DI
+  case 0xfb: // EI
+    return 1;
+  }
+  return (op & 0xf8) == 0x70 || // MOV M, r
+         (op & 0xcb) == 0xc1;   // PUSH, POP
+}
 
-    // Sign Flag (if bit 7 is set)
-    if (answer & 0x80)
-      state->cc.s = 1;
-    else
-      state->cc.s = 0;
+// Tries a block gets at coming round to the same registers before it stops
+// being watched as a possible idle loop
+#define IDLE_TRIES 4
 
-    // Carry Flag
-    if (answer > 0xff)
-      state->cc.cy = 1;
-    else
-      state->cc.cy = 0;
-
-    // Parity
-    state->cc.p = Parity(answer, 8);
-
-    state->a = answer & 0xff;
-  } break;
-  case 0x81: // ADD    C
-  {
-    uint16_t answer = (uint16_t)state->a + (uint16_t)state->c;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x82: // ADD    D
-  {
-    uint16_t answer = (uint16_t)state->a + (uint16_t)state->d;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x83: // ADD E
-  {
-    uint16_t answer = (uint16_t)state->a + (uint16_t)state->e;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x84: // ADD    H
-  {
-    uint16_t answer = (uint16_t)state->a + (uint16_t)state->h;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x85: // ADD    L
-  {
-    uint16_t answer = (uint16_t)state->a + (uint16_t)state->l;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x86: // ADD    M
-  {
-    uint16_t offset = (state->h << 8) | (state->l);
-    uint16_t answer = (uint16_t)state->a + state->memory[offset];
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x87: // ADD    A
-  {
-    uint16_t answer = (uint16_t)state->a + (uint16_t)state->a;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x88: // ADC  B
-  {
-    uint16_t answer =
-        (uint16_t)state->a + (uint16_t)state->b + (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x89: // ADC  C
-  {
-    uint16_t answer =
-        (uint16_t)state->a + (uint16_t)state->c + (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x8a: // ADC  D
-  {
-    uint16_t answer =
-        (uint16_t)state->a + (uint16_t)state->d + (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x8b: // ADC  E
-  {
-    uint16_t answer =
-        (uint16_t)state->a + (uint16_t)state->e + (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x8c: // ADC  H
-  {
-    uint16_t answer =
-        (uint16_t)state->a + (uint16_t)state->h + (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x8d: // ADC  L
-  {
-    uint16_t answer =
-        (uint16_t)state->a + (uint16_t)state->l + (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x8e: // ADC  M
-  {
-    uint16_t offset = (state->h << 8) | (state->l);
-    uint16_t answer =
-        (uint16_t)state->a + state->memory[offset] + (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x8f: // ADC  A
-  {
-    uint16_t answer =
-        (uint16_t)state->a + (uint16_t)state->a + (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x90: // SUB  B
-  {
-    uint16_t answer = (uint16_t)state->a - (uint16_t)state->b;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x91: // SUB  C
-  {
-    uint16_t answer = (uint16_t)state->a - (uint16_t)state->c;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x92: // SUB  D
-  {
-    uint16_t answer = (uint16_t)state->a - (uint16_t)state->d;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x93: // SUB  E
-  {
-    uint16_t answer = (uint16_t)state->a - (uint16_t)state->e;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x94: // SUB  H
-  {
-    uint16_t answer = (uint16_t)state->a - (uint16_t)state->h;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x95: // SUB  L
-  {
-    uint16_t answer = (uint16_t)state->a - (uint16_t)state->l;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x96: // SUB  M
-  {
-    uint16_t offset = (state->h << 8) | (state->l);
-    uint16_t answer = (uint16_t)state->a - state->memory[offset];
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x97: // SUB  A
-  {
-    uint16_t answer = (uint16_t)state->a - (uint16_t)state->a;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x98: // SBB  B
-  {
-    uint16_t answer =
-        (uint16_t)state->a - (uint16_t)state->b - (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x99: // SBB  C
-  {
-    uint16_t answer =
-        (uint16_t)state->a - (uint16_t)state->c - (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x9a: // SBB  D
-  {
-    uint16_t answer =
-        (uint16_t)state->a - (uint16_t)state->d - (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x9b: // SBB  E
-  {
-    uint16_t answer =
-        (uint16_t)state->a - (uint16_t)state->e - (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x9c: // SBB  H
-  {
-    uint16_t answer =
-        (uint16_t)state->a - (uint16_t)state->h - (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x9d: // SBB  L
-  {
-    uint16_t answer =
-        (uint16_t)state->a - (uint16_t)state->l - (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x9e: // SBB  M
-  {
-    uint16_t offset = (state->h << 8) | (state->l);
-    uint16_t answer =
-        (uint16_t)state->a - state->memory[offset] - (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0x9f: // SBB  A
-  {
-    uint16_t answer =
-        (uint16_t)state->a - (uint16_t)state->a - (uint16_t)state->cc.cy;
-    state->cc.z = ((answer & 0xff) == 0);
-    state->cc.s = ((answer & 0x80) != 0);
-    state->cc.cy = (answer > 0xff);
-    state->cc.p = Parity(answer, 8);
-    state->a = answer & 0xff;
-  } break;
-  case 0xa0:
-    unimplementedInst(state);
-    break;
-  case 0xa1:
-    unimplementedInst(state);
-    break;
-  case 0xa2:
-    unimplementedInst(state);
-    break;
-  case 0xa3:
-    unimplementedInst(state);
-    break;
-  case 0xa4:
-    unimplementedInst(state);
-    break;
-  case 0xa5:
-    unimplementedInst(state);
-    break;
-  case 0xa6:
-    unimplementedInst(state);
-    break;
-  case 0xa7:
-    unimplementedInst(state);
-    break;
-  case 0xa8:
-    unimplementedInst(state);
-    break;
-  case 0xa9:
-    unimplementedInst(state);
-    break;
-  case 0xaa:
-    unimplementedInst(state);
-    break;
-  case 0xab:
-    unimplementedInst(state);
-    break;
-  case 0xac:
-    unimplementedInst(state);
-    break;
-  case 0xad:
-    unimplementedInst(state);
-    break;
-  case 0xae:
-    unimplementedInst(state);
-    break;
-  case 0xaf:
-    unimplementedInst(state);
-    break;
-  case 0xb0:
-    unimplementedInst(state);
-    break;
-  case 0xb1:
-    unimplementedInst(state);
-    break;
-  case 0xb2:
-    unimplementedInst(state);
-    break;
-  case 0xb3:
-    unimplementedInst(state);
-    break;
-  case 0xb4:
-    unimplementedInst(state);
-    break;
-  case 0xb5:
-    unimplementedInst(state);
-    break;
-  case 0xb6:
-    unimplementedInst(state);
-    break;
-  case 0xb7:
-    unimplementedInst(state);
-    break;
-  case 0xb8:
-    unimplementedInst(state);
-    break;
-  case 0xb9:
-    unimplementedInst(state);
-    break;
-  case 0xba:
-    unimplementedInst(state);
-    break;
-  case 0xbb:
-    unimplementedInst(state);
-    break;
-  case 0xbc:
-    unimplementedInst(state);
-    break;
-  case 0xbd:
-    unimplementedInst(state);
-    break;
-  case 0xbe:
-    unimplementedInst(state);
-    break;
-  case 0xbf:
-    unimplementedInst(state);
-    break;
-  case 0xc0: // RNZ
-    if (0 == state->cc.z) {
-      state->pc =
-          state->memory[state->sp] | (state->memory[state->sp + 1] << 8);
-      state->sp += 2;
-    }
-    break;
-  case 0xc1:
-    unimplementedInst(state);
-    break;
-  case 0xc2: // JNZ  adr
-    if (0 == state->cc.z)
-      state->pc = (opcode[2] << 8) | opcode[1];
-    else
-      state->pc += 2;
-    break;
-  case 0xc3: // JMP adr
-    state->pc = (opcode[2] << 8) | opcode[1];
-    break;
-  case 0xc4: // CNZ adr
-    if (0 == state->cc.z) {
-      uint16_t ret = state->pc + 2;
-      state->memory[state->sp - 1] = (ret >> 8) & 0xff;
-      state->memory[state->sp - 2] = (ret & 0xff);
-      state->sp = state->sp - 2;
-      state->pc = (opcode[2] << 8) | opcode[1];
-    } else
-      state->pc += 2;
-    break;
-  case 0xc5:
-    unimplementedInst(state);
-    break;
-  case 0xc6:
-    unimplementedInst(state);
-    break;
-  case 0xc7: // RST 0
-  {
-    uint16_t ret = state->pc + 2;
-    state->memory[state->sp - 1] = (ret >> 8) & 0xff;
-    state->memory[state->sp - 2] = (ret & 0xff);
-    state->sp = state->sp - 2;
-    state->pc = 0x00;
-  } break;
-  case 0xc8: // RZ
-    if (1 == state->cc.z) {
-      state->pc =
-          state->memory[state->sp] | (state->memory[state->sp + 1] << 8);
-      state->sp += 2;
-    }
-    break;
-  case 0xc9: // RET
-    state->pc = state->memory[state->sp] | (state->memory[state->sp + 1] << 8);
-    state->sp += 2;
-    break;
-  case 0xca: // JZ adr
-    if (1 == state->cc.z)
-      state->pc = (opcode[2] << 8) | opcode[1];
+static int idle_loop(const Block8080 *b) {
+  // Whether `b` could be a wait loop: it jumps back to its own start and
+  // nothing in it has side effects. If it comes round to the registers it
+  // started with it will keep doing so until an interrupt.
+  const Decoded8080 *last = &b->insts[b->count - 1];
+  if (last->opcode != 0xc3 && last->opcode != 0xcb &&
+      (last->opcode & 0xc7) != 0xc2)
+    return 0;
+  if (last->imm != b->start)
+    return 0;
+  for (int i = 0; i < b->count - 1; i++)
+    if (side_effects(b->insts[i].opcode))
+      return 0;
+  return 1;
+}
+
+#ifdef SUPERINSTRUCTIONS
+// Superinstructions: common pairs and triples found in the block when it
+// is built run as one handler, saving dispatches and letting the handler
+// use what the first instruction computed (a loop counter hitting zero
+// decides the JNZ without working out the flags). The keys follow the 256
+// opcodes, the DCR, CMP and MOV M families take one per register field and
+// LDAX/STAX one per pair.
+#define FUSE_DCR_JNZ 0x100     // + r: DCR r; JNZ
+#define FUSE_CMP_JZ 0x108      // + r: CMP r; JZ or JNZ
+#define FUSE_CPI_JZ 0x110      // CPI; JZ or JNZ
+#define FUSE_LDAX_INX 0x111    // + B/D: LDAX rp; INX rp
+#define FUSE_STAX_INX 0x113    // + B/D: STAX rp; INX rp
+#define FUSE_LXIH_MOVM 0x115   // + r: LXI H; MOV M,r
+#define FUSE_LDAX_MOVM 0x11d   // LDAX D; MOV M,A; INX H, a copy loop body
+#define DISPATCH_KEYS 0x11e
+
+static int fuse_pair(uint8_t first, uint8_t second) {
+  // Key for `first` followed by `second`, or 0 if they do not fuse
+  int r = (first >> 3) & 7;
+  int jz = second == 0xc2 || second == 0xca;
+  if ((first & 0xc7) == 0x05 && r != 6 && second == 0xc2)
+    return FUSE_DCR_JNZ + r;
+  if (first >= 0xb8 && first <= 0xbf && first != 0xbe && jz)
+    return FUSE_CMP_JZ + (first & 7);
+  if (first == 0xfe && jz)
+    return FUSE_CPI_JZ;
+  if ((first == 0x0a || first == 0x1a) && second == (first & 0xf0) + 3)
+    return FUSE_LDAX_INX + (first >> 4);
+  if ((first == 0x02 || first == 0x12) && second == (first & 0xf0) + 3)
+    return FUSE_STAX_INX + (first >> 4);
+  if (first == 0x21 && (second & 0xf8) == 0x70 && second != 0x76)
+    return FUSE_LXIH_MOVM + (second & 7);
+  return 0;
+}
+
+static int fused_length(int key) {
+  // Instructions a fused key stands for
+  return key == FUSE_LDAX_MOVM ? 3 : key > 0xff ? 2 : 1;
+}
+
+static void fuse_block(Block8080 *b) {
+  // Picks keys from the start of the block on, a triple before the pair
+  // at the same instruction
+  for (int i = 0; i < b->count; i++)
+    b->insts[i].key = b->insts[i].opcode;
+  for (int i = 0; i + 1 < b->count; i++) {
+    Decoded8080 *d = &b->insts[i];
+    int key;
+    if (i + 2 < b->count && d[0].opcode == 0x1a && d[1].opcode == 0x77 &&
+        d[2].opcode == 0x23)
+      key = FUSE_LDAX_MOVM;
     else
-      state->pc += 2;
-    break;
-  case 0xcb: //????
-    unimplementedInst(state);
-    break;
-  case 0xcc: // CZ adr
-    if (1 == state->cc.z) {
-      uint16_t ret = state->pc + 2;
-      state->memory[state->sp - 1] = (ret >> 8) & 0xff;
-      state->memory[state->sp - 2] = (ret & 0xff);
-      state->sp = state->sp - 2;
-      state->pc = (opcode[2] << 8) | opcode[1];
-    } else
-      state->pc += 2;
-    break;
-  case 0xcd: { // CALL adr
-    uint16_t ret = state->pc + 2;
-    state->memory[state->sp - 1] = (ret >> 8) & 0xff;
-    state->memory[state->sp - 2] = (ret & 0xff);
-    state->sp = state->sp - 2;
-    state->pc = (opcode[2] << 8) | opcode[1];
-  } break;
-  case 0xce:
-    unimplementedInst(state);
-    break;
-  case 0xcf: // RST 1
-  {
-    uint16_t ret = state->pc + 2;
-    state->memory[state->sp - 1] = (ret >> 8) & 0xff;
-    state->memory[state->sp - 2] = (ret & 0xff);
-    state->sp = state->sp - 2;
-    state->pc = 0x08;
-  } break;
-  case 0xd0: // RNC
-    if (0 == state->cc.cy) {
-      state->pc =
-          state->memory[state->sp] | (state->memory[state->sp + 1] << 8);
-      state->sp += 2;
-    }
-    break;
-  case 0xd1:
-    unimplementedInst(state);
-    break;
-  case 0xd2:
-    unimplementedInst(state);
-    break;
-  case 0xd3:
-    unimplementedInst(state);
-    break;
-  case 0xd4: // CNC adr
-    if (0 == state->cc.cy) {
-      uint16_t ret = state->pc + 2;
-      state->memory[state->sp - 1] = (ret >> 8) & 0xff;
-      state->memory[state->sp - 2] = (ret & 0xff);
-      state->sp = state->sp - 2;
-      state->pc = 0x00;
-    } else
-      state->pc += 2;
-    break;
-  case 0xd5:
-    unimplementedInst(state);
-    break;
-  case 0xd6:
-    unimplementedInst(state);
-    break;
-  case 0xd7:
-    unimplementedInst(state);
-    break;
-  case 0xd8: // RC
-    if (1 == state->cc.cy) {
-      state->pc =
-          state->memory[state->sp] | (state->memory[state->sp + 1] << 8);
-      state->sp += 2;
+      key = fuse_pair(d[0].opcode, d[1].opcode);
+    if (key) {
+      d->key = key;
+      i += fused_length(key) - 1;
     }
-    break;
-  case 0xd9:
-    unimplementedInst(state);
-    break;
-  case 0xda:
-    unimplementedInst(state);
-    break;
-  case 0xdb:
-    unimplementedInst(state);
-    break;
-  case 0xdc: // CC adr
-    if (1 == state->cc.cy) {
-      uint16_t ret = state->pc + 2;
-      state->memory[state->sp - 1] = (ret >> 8) & 0xff;
-      state->memory[state->sp - 2] = (ret & 0xff);
-      state->sp = state->sp - 2;
-      state->pc = 0x00;
-    } else
-      state->pc += 2;
-    break;
-  case 0xdd:
-    unimplementedInst(state);
-    break;
-  case 0xde:
-    unimplementedInst(state);
-    break;
-  case 0xdf:
-    unimplementedInst(state);
-    break;
-  case 0xe0:
-    unimplementedInst(state);
-    break;
-  case 0xe1:
-    unimplementedInst(state);
-    break;
-  case 0xe2:
-    unimplementedInst(state);
-    break;
-  case 0xe3:
-    unimplementedInst(state);
-    break;
-  case 0xe4:
-    unimplementedInst(state);
-    break;
-  case 0xe5:
-    unimplementedInst(state);
-    break;
-  case 0xe6:
-    unimplementedInst(state);
-    break;
-  case 0xe7:
-    unimplementedInst(state);
-    break;
-  case 0xe8:
-    unimplementedInst(state);
-    break;
-  case 0xe9:
-    unimplementedInst(state);
-    break;
-  case 0xea:
-    unimplementedInst(state);
-    break;
-  case 0xeb:
-    unimplementedInst(state);
-    break;
-  case 0xec:
-    unimplementedInst(state);
-    break;
-  case 0xed:
-    unimplementedInst(state);
-    break;
-  case 0xee:
-    unimplementedInst(state);
-    break;
-  case 0xef:
-    unimplementedInst(state);
-    break;
-  case 0xf0:
-    unimplementedInst(state);
-    break;
-  case 0xf1:
-    unimplementedInst(state);
-    break;
-  case 0xf2:
-    unimplementedInst(state);
-    break;
-  case 0xf3:
-    unimplementedInst(state);
-    break;
-  case 0xf4:
-    unimplementedInst(state);
-    break;
-  case 0xf5:
-    unimplementedInst(state);
-    break;
-  case 0xf6:
-    unimplementedInst(state);
-    break;
-  case 0xf7:
-    unimplementedInst(state);
-    break;
-  case 0xf8:
-    unimplementedInst(state);
-    break;
-  case 0xf9:
-    unimplementedInst(state);
-    break;
-  case 0xfa:
-    unimplementedInst(state);
-    break;
-  case 0xfb:
-    unimplementedInst(state);
-    break;
-  case 0xfc:
-    unimplementedInst(state);
-    break;
-  case 0xfd:
-    unimplementedInst(state);
-    break;
-  case 0xfe:
-    unimplementedInst(state);
-    break;
-  case 0xff:
-    unimplementedInst(state);
-    break;
   }
-  return 0; // placeholder
 }
 
-int disassemble(unsigned char *buffer, int pc); // disassembler decl
-int main(int argc, char **argv) {
-  FILE *f = fopen(argv[1], "rb");
-  if (f == NULL) {
-    printf("Error: could not open %s\n", argv[1]);
-    exit(1);
+// Profile of what the cached blocks ran, folded in when they are flushed:
+// fused instructions by key and the pairs left unfused by opcode
+static uint64_t fused_runs[DISPATCH_KEYS];
+static uint64_t pair_runs[256][256];
+static uint64_t insts_run;
+
+static void fusion_profile(BlockCache8080 *cache) {
+  for (int i = 0; i < cache->used; i++) {
+    Block8080 *b = &cache->pool[i];
+    for (int j = 0; j < b->count; j++) {
+      Decoded8080 *d = &b->insts[j];
+      if (d->key > 0xff) {
+        fused_runs[d->key] += b->runs;
+        insts_run += fused_length(d->key) * b->runs;
+        j += fused_length(d->key) - 1;
+      } else {
+        insts_run += b->runs;
+        if (j + 1 < b->count)
+          pair_runs[d->opcode][d[1].opcode] += b->runs;
+      }
+    }
+    b->runs = 0;
   }
-  // Read code into into buffer
-  fseek(f, 0L, SEEK_END);
-  int fsize = ftell(f); // grabbing total file size
-  fseek(f, 0L, SEEK_SET);
-  unsigned char *buffer = malloc(fsize);
-  fread(buffer, fsize, 1, f);
-  fclose(f);
-  // Perform Disassembly
-  int pc = 0;
-  while (pc < fsize) {
-    pc += disassemble(buffer, pc);
+}
+
+void fusion_report(State8080 *state) {
+  // Prints how often each fused pair or triple ran and the unfused pairs
+  // that ran most, the candidates for new superinstructions. Listing them
+  // uses up the unfused counts.
+  static const char *families[] = {
+      "DCR r; JNZ",     "CMP r; JZ/JNZ",  "CPI; JZ/JNZ",
+      "LDAX B; INX B",  "LDAX D; INX D",  "STAX B; INX B",
+      "STAX D; INX D",  "LXI H; MOV M,r", "LDAX D; MOV M,A; INX H"};
+  static const int first_key[] = {
+      FUSE_DCR_JNZ,      FUSE_CMP_JZ,        FUSE_CPI_JZ,
+      FUSE_LDAX_INX,     FUSE_LDAX_INX + 1,  FUSE_STAX_INX,
+      FUSE_STAX_INX + 1, FUSE_LXIH_MOVM,     FUSE_LDAX_MOVM,
+      DISPATCH_KEYS};
+  int count = sizeof(families) / sizeof(families[0]);
+  if (state->blocks != NULL)
+    fusion_profile(state->blocks);
+  uint64_t saved = 0;
+  printf("fused                    runs (dispatches saved)\n");
+  for (int f = 0; f < count; f++) {
+    uint64_t runs = 0;
+    for (int k = first_key[f]; k < first_key[f + 1]; k++)
+      runs += fused_runs[k];
+    printf("  %-22s %12llu\n", families[f], (unsigned long long)runs);
+    saved += runs * (fused_length(first_key[f]) - 1);
+  }
+  printf("  %llu of %llu dispatches saved (%.1f%%)\n",
+         (unsigned long long)saved, (unsigned long long)insts_run,
+         insts_run ? 100.0 * saved / insts_run : 0.0);
+  printf("top unfused pairs\n");
+  for (int n = 0; n < 8; n++) {
+    int best = 0;
+    for (int p = 1; p < 0x10000; p++)
+      if (pair_runs[p >> 8][p & 0xff] > pair_runs[best >> 8][best & 0xff])
+        best = p;
+    uint64_t runs = pair_runs[best >> 8][best & 0xff];
+    if (runs == 0)
+      break;
+    uint8_t first = best >> 8, second = best & 0xff;
+    char name[32];
+    snprintf(name, sizeof(name), "%s%s%s; %s%s%s", mnemonic8080[first],
+             operands8080[first][0] ? " " : "", operands8080[first],
+             mnemonic8080[second], operands8080[second][0] ? " " : "",
+             operands8080[second]);
+    printf("  %-22s %12llu\n", name, (unsigned long long)runs);
+    pair_runs[best >> 8][best & 0xff] = 0;
+  }
+}
+#endif
+
+static void flush_blocks(State8080 *state) {
+  BlockCache8080 *cache = state->blocks;
+#ifdef SUPERINSTRUCTIONS
+  fusion_profile(cache);
+#endif
+  memset(cache->map, 0, sizeof(cache->map));
+  memset(cache->pages, 0, sizeof(cache->pages));
+  cache->used = 0;
+#ifdef JIT
+  if (state->jit != NULL)
+    state->jit->used = 0;
+#endif
+}
+
+static Block8080 *build_block(State8080 *state, uint16_t pc,
+                              const void *const *handlers) {
+  // Decodes the block starting at `pc`, `handlers` is the threaded
+  // dispatch table (NULL for the switch loop)
+  BlockCache8080 *cache = state->blocks;
+  if (cache->used == BLOCK_POOL_SIZE)
+    flush_blocks(state);
+  Block8080 *b = &cache->pool[cache->used++];
+  b->start = pc;
+  b->count = 0;
+  b->valid = 1;
+  b->next[0] = b->next[1] = NULL;
+#ifdef JIT
+  b->native = NULL;
+  b->hits = 0;
+#endif
+  do {
+    Decoded8080 *d = &b->insts[b->count++];
+    decode8080(state, d, pc);
+    pc += d->len;
+  } while (b->count < BLOCK_MAX_INSTS &&
+           !block_end8080[b->insts[b->count - 1].opcode]);
+  b->end = pc;
+  b->idle = idle_loop(b) ? IDLE_TRIES : 0;
+#ifdef SUPERINSTRUCTIONS
+  b->runs = 0;
+  fuse_block(b);
+#endif
+#ifdef THREADED_DISPATCH
+  for (int i = 0; i < b->count; i++)
+    b->insts[i].handler = handlers[DISPATCH_KEY(&b->insts[i])];
+#else
+  (void)handlers;
+#endif
+  cache->map[b->start] = b;
+  b->page_next = cache->pages[b->start >> 8];
+  cache->pages[b->start >> 8] = b;
+  return b;
+}
+
+static Block8080 *next_block(State8080 *state, Block8080 *prev, uint16_t pc,
+                             const void *const *handlers) {
+  // Finds the block at `pc`, through the chain from the block that just ran
+  // if possible, building it if it is not cached yet
+  if (prev != NULL) {
+    for (int i = 0; i < 2; i++) {
+      Block8080 *b = prev->next[i];
+      if (b != NULL && b->start == pc && b->valid)
+        return b;
+    }
+  }
+  Block8080 *b = state->blocks->map[pc];
+  if (b == NULL) {
+    int used = state->blocks->used;
+    b = build_block(state, pc, handlers);
+    if (state->blocks->used < used)
+      return b; // the cache was flushed, prev is gone
+  }
+  if (prev != NULL && prev->valid)
+    prev->next[prev->next[0] != NULL] = b;
+  return b;
+}
+
+int invalidate_code(State8080 *state, uint16_t addr) {
+  // Drops the cached blocks covering `addr`. Blocks are shorter than a page
+  // so only those starting in this page or the one before can reach it.
+  // Returns the number of blocks dropped.
+  int dropped = 0;
+  if (state->blocks == NULL)
+    return 0;
+  for (int p = 0; p < 2; p++) {
+    Block8080 **link = &state->blocks->pages[(uint8_t)((addr >> 8) - p)];
+    while (*link != NULL) {
+      Block8080 *b = *link;
+      if ((uint16_t)(addr - b->start) < (uint16_t)(b->end - b->start)) {
+        b->valid = 0;
+        state->blocks->map[b->start] = NULL;
+        *link = b->page_next;
+        dropped++;
+      } else {
+        link = &b->page_next;
+      }
+    }
+  }
+  return dropped;
+}
+
+static int invalidate_mirrors(State8080 *state, uint16_t addr) {
+  // Drops the blocks fetched through mirrors of `addr`
+  int dropped = 0;
+  for (int p = 0; p < 256; p++)
+    if ((state->pages[p] & PAGE_MIRROR) && state->page_map[p] == addr >> 8)
+      dropped += invalidate_code(state, p << 8 | (addr & 0xff));
+  return dropped;
+}
+
+static int write_slow(State8080 *state, uint16_t addr, uint8_t value) {
+  // write_mem() for pages with PAGE_* bits
+  if (state->pages[addr >> 8] & PAGE_MIRROR)
+    addr = unmirror(state, addr);
+  uint8_t page = state->pages[addr >> 8];
+  if (page & PAGE_MMIO) {
+    state->mmio[state->page_map[addr >> 8]]->write(state, addr, value);
+    return 0;
+  }
+  if (page & PAGE_ROM)
+    return 0;
+  if ((page & PAGE_VIDEO) && state->memory[addr] != value)
+    video_dirty_line(&state->video_dirty, addr - state->video_start);
+  state->memory[addr] = value;
+  if (addr < MEMORY_TAIL)
+    state->memory[MEMORY_SIZE + addr] = value;
+  int dropped = 0;
+  if (page & PAGE_CODE) {
+#ifdef STATIC_ROM
+    if (addr < state->static_rom) {
+      state->static_rom = 0;
+      dropped++;
+    }
+#endif
+    dropped += invalidate_code(state, addr);
+  }
+  if (page & PAGE_ALIASED)
+    dropped += invalidate_mirrors(state, addr);
+  return dropped;
+}
+
+static inline int write_mem(State8080 *state, uint16_t addr, uint8_t value) {
+  // Stores a byte, returns nonzero if that overwrote cached code
+  if (state->pages[addr >> 8] == 0) {
+    state->memory[addr] = value;
+    return 0;
+  }
+  return write_slow(state, addr, value);
+}
+
+uint8_t *alloc_memory(void) {
+  // Zeroed 64K address space plus its tail, NULL if out of memory
+  return calloc(MEMORY_SIZE + MEMORY_TAIL, 1);
+}
+
+void attach_memory(State8080 *state, uint8_t *memory) {
+  // Runs `state` on memory from alloc_memory(). Call it again after
+  // writing to memory directly, it refreshes the tail copy.
+  state->memory = memory;
+  memcpy(memory + MEMORY_SIZE, memory, MEMORY_TAIL);
+  state->pages[0] |= PAGE_TAIL;
+}
+
+static void map_pages(State8080 *state, uint16_t start, uint32_t size,
+                      uint8_t kind, uint8_t arg) {
+  // Gives the whole pages in [start, start + size) a new kind. Code cached
+  // from them was read under the old one, so the block cache starts over.
+  for (uint32_t a = start; a < (uint32_t)start + size; a += 0x100) {
+    uint8_t page = a >> 8;
+    state->pages[page] &= ~(PAGE_ROM | PAGE_MMIO | PAGE_MIRROR);
+    state->pages[page] |= kind;
+    state->page_map[page] = arg;
+  }
+  if (state->blocks != NULL)
+    flush_blocks(state);
+}
+
+void map_rom(State8080 *state, uint16_t start, uint32_t size) {
+  // Makes the pages read-only, stores into them are dropped
+  map_pages(state, start, size, PAGE_ROM, 0);
+}
+
+void map_mirror(State8080 *state, uint16_t start, uint32_t size,
+                uint16_t target) {
+  // Makes the pages another view of as many pages at `target`. Map the
+  // target first.
+  for (uint32_t a = 0; a < size; a += 0x100) {
+    uint16_t to = target + a;
+    if (state->pages[to >> 8] & PAGE_MIRROR)
+      to = unmirror(state, to);
+    map_pages(state, start + a, 0x100, PAGE_MIRROR, to >> 8);
+  }
+}
+
+int map_mmio(State8080 *state, uint16_t start, uint32_t size,
+             const Mmio8080 *device) {
+  // Sends loads and stores in the pages to `device`. Returns 0 if every
+  // slot is taken.
+  int slot = 0;
+  while (slot < MMIO_SLOTS && state->mmio[slot] != NULL &&
+         state->mmio[slot] != device)
+    slot++;
+  if (slot == MMIO_SLOTS)
+    return 0;
+  state->mmio[slot] = device;
+  map_pages(state, start, size, PAGE_MMIO, slot);
+  return 1;
+}
+
+int map_video(State8080 *state, uint16_t start, uint32_t size) {
+  // Tracks which lines of the video RAM at `start` stores change, see
+  // take_video_dirty(). All of them start out changed. Returns 0 unless
+  // start and size are whole pages and size fits the screen, every store
+  // to a PAGE_VIDEO page must land on a line VideoDirty has.
+  if (((start | size) & 0xff) || size > VRAM_SIZE ||
+      (uint32_t)start + size > MEMORY_SIZE)
+    return 0;
+  for (int page = 0; page < 256; page++)
+    state->pages[page] &= ~PAGE_VIDEO;
+  for (uint32_t a = start; a < (uint32_t)start + size; a += 0x100)
+    state->pages[a >> 8] |= PAGE_VIDEO;
+  state->video_start = start;
+  for (uint32_t a = 0; a < size; a += VRAM_LINE_BYTES)
+    video_dirty_line(&state->video_dirty, a);
+  return 1;
+}
+
+uint32_t take_video_dirty(State8080 *state, VideoDirty *dirty) {
+  // Hands over the lines changed since the last call and starts a new set,
+  // returns their groups for the renderer, 0 if the screen is unchanged.
+  // Hosts writing to video memory directly should call map_video() again.
+  *dirty = state->video_dirty;
+  memset(&state->video_dirty, 0, sizeof(state->video_dirty));
+  return video_dirty_groups(dirty);
+}
+
+// A machine as it was, to run ahead from and come back to: the whole
+// State8080 (registers, page layout, ports, scheduled events, changed video
+// lines) and the bytes of the pages stores can change. ROM and device pages
+// are left out, as are mirrors, which only show another page. Devices keep
+// their own state and hosts save that alongside. Zero it before first use.
+#define SNAPSHOT_SKIP (PAGE_ROM | PAGE_MMIO | PAGE_MIRROR)
+typedef struct Snapshot8080 {
+  State8080 state;
+  uint8_t *memory; // from alloc_memory(), only the saved pages filled in
+} Snapshot8080;
+
+int save_state(const State8080 *state, Snapshot8080 *snap) {
+  // Returns 0 if out of memory
+  if (snap->memory == NULL && (snap->memory = alloc_memory()) == NULL)
+    return 0;
+  snap->state = *state;
+  for (int page = 0; page < 256;) {
+    if (state->pages[page] & SNAPSHOT_SKIP) {
+      page++;
+      continue;
+    }
+    int end = page + 1; // one memcpy for each run of saved pages
+    while (end < 256 && !(state->pages[end] & SNAPSHOT_SKIP))
+      end++;
+    memcpy(snap->memory + (page << 8), state->memory + (page << 8),
+           (end - page) << 8);
+    page = end;
+  }
+  return 1;
+}
+
+void restore_state(State8080 *state, const Snapshot8080 *snap) {
+  // Puts `state` back as save_state() found it, the same memory, block
+  // cache and JIT. The layout must not have been remapped in between. Code
+  // cached since then stays, so its pages keep PAGE_CODE, unless stores
+  // changed bytes the cache holds code from.
+  int stale = 0;
+  uint8_t code[256];
+  for (int page = 0; page < 256; page++) {
+    code[page] = state->pages[page] & (PAGE_CODE | PAGE_ALIASED);
+    if (snap->state.pages[page] & SNAPSHOT_SKIP)
+      continue;
+    uint8_t *to = state->memory + (page << 8);
+    const uint8_t *from = snap->memory + (page << 8);
+    if (code[page] && memcmp(to, from, 0x100) != 0)
+      stale = 1;
+    memcpy(to, from, 0x100);
+  }
+  if (!(snap->state.pages[0] & SNAPSHOT_SKIP))
+    memcpy(state->memory + MEMORY_SIZE, state->memory, MEMORY_TAIL);
+  BlockCache8080 *blocks = state->blocks;
+#ifdef JIT
+  Jit8080 *jit = state->jit;
+#endif
+  *state = snap->state;
+  state->blocks = blocks;
+#ifdef JIT
+  state->jit = jit;
+#endif
+  for (int page = 0; page < 256; page++)
+    state->pages[page] |= code[page];
+  if (stale)
+    flush_blocks(state);
+}
+
+// Zero, sign and parity flags of every byte value
+static const uint8_t zsp8080[256] = {
+    0x44, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, // 0x00
+    0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, // 0x10
+    0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, // 0x20
+    0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, // 0x30
+    0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, // 0x40
+    0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, // 0x50
+    0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, // 0x60
+    0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, // 0x70
+    0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, // 0x80
+    0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, // 0x90
+    0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, // 0xa0
+    0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, // 0xb0
+    0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, // 0xc0
+    0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, // 0xd0
+    0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, // 0xe0
+    0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, // 0xf0
+};
+
+// Sets Z/S/P from `answer` and AC from bit 4 of `aux`, leaving CY alone.
+// With -DLAZY_FLAGS the result is only recorded, and Z/S/P/AC are worked
+// out by sync_flags() when a conditional branch, PUSH PSW, DAA or the host
+// needs them. CY is always kept current since ADC/SBB, the rotates and half
+// the branches read it.
+static inline void flags_zspa(State8080 *state, uint8_t answer, uint8_t aux) {
+#ifdef LAZY_FLAGS
+  state->flag_res = answer;
+  state->flag_aux = aux;
+  state->flags_pending = 1;
+#else
+  state->f = zsp8080[answer] | (aux & FLAG_AC) | (state->f & FLAG_CY);
+#endif
+}
+
+// As flags_zspa() and sets CY to `cy` (0 or 1)
+static inline void flags_result(State8080 *state, uint8_t answer, uint8_t aux,
+                                uint8_t cy) {
+#ifdef LAZY_FLAGS
+  flags_zspa(state, answer, aux);
+  state->f = (state->f & ~FLAG_CY) | cy;
+#else
+  state->f = zsp8080[answer] | (aux & FLAG_AC) | cy;
+#endif
+}
+
+static inline void sync_flags(State8080 *state) {
+#ifdef LAZY_FLAGS
+  if (state->flags_pending) {
+    state->f = zsp8080[state->flag_res] | (state->flag_aux & FLAG_AC) |
+               (state->f & FLAG_CY);
+    state->flags_pending = 0;
+  }
+#else
+  (void)state;
+#endif
+}
+
+static inline void set_carry(State8080 *state, uint8_t cy) {
+  state->f = (state->f & ~FLAG_CY) | cy;
+}
+
+// ALU helpers shared by the register, memory and immediate forms. The sum is
+// formed one bit wider so the carry falls out of bit 8, and the carry into
+// bit 4 (AC) is the bit where the operands and the sum disagree.
+static inline uint8_t alu_add(State8080 *state, uint8_t a, uint8_t val,
+                              uint8_t carry) {
+  uint16_t answer = a + val + carry;
+  flags_result(state, answer, a ^ val ^ answer, answer >> 8);
+  return answer & 0xff;
+}
+
+static inline uint8_t alu_sub(State8080 *state, uint8_t a, uint8_t val,
+                              uint8_t borrow) {
+  // The 8080 subtracts by adding the complement, CY ends up as the borrow
+  uint8_t inv = ~val;
+  uint16_t answer = a + inv + !borrow;
+  flags_result(state, answer, a ^ inv ^ answer, !(answer >> 8));
+  return answer & 0xff;
+}
+
+static inline uint8_t alu_inr(State8080 *state, uint8_t val) {
+  // Adding 1 (or 0xff for DCR) leaves CY alone but sets AC like an ADD
+  uint8_t answer = val + 1;
+  flags_zspa(state, answer, val ^ 0x01 ^ answer);
+  return answer;
+}
+
+static inline uint8_t alu_dcr(State8080 *state, uint8_t val) {
+  uint8_t answer = val - 1;
+  flags_zspa(state, answer, val ^ 0xff ^ answer);
+  return answer;
+}
+
+static inline void alu_daa(State8080 *state) {
+  sync_flags(state);
+  uint8_t correction = 0;
+  uint8_t cy = state->f & FLAG_CY;
+  uint8_t lsb = state->a & 0x0f;
+  uint8_t msb = state->a >> 4;
+  if ((state->f & FLAG_AC) || lsb > 9)
+    correction += 0x06;
+  if (cy || msb > 9 || (msb >= 9 && lsb > 9)) {
+    correction += 0x60;
+    cy = 1;
+  }
+  state->a = alu_add(state, state->a, correction, 0);
+  set_carry(state, cy);
+}
+
+static inline uint8_t alu_ana(State8080 *state, uint8_t a, uint8_t val) {
+  // AND sets AC to the OR of the operands' bit 3, and clears CY
+  uint8_t answer = a & val;
+  flags_result(state, answer, (a | val) << 1, 0);
+  return answer;
+}
+
+static inline uint8_t alu_logic(State8080 *state, uint8_t answer) {
+  // XRA and ORA clear both carries
+  flags_result(state, answer, 0, 0);
+  return answer;
+}
+
+// The flags byte PUSH PSW stores, S Z 0 AC 0 P 1 CY
+static inline uint8_t psw_flags(State8080 *state) {
+  sync_flags(state);
+  return state->f | 0x02;
+}
+
+static inline void set_psw_flags(State8080 *state, uint8_t psw) {
+  state->f = psw & FLAGS_PSW;
+#ifdef LAZY_FLAGS
+  state->flags_pending = 0;
+#endif
+}
+
+static inline uint16_t pop16(State8080 *state) {
+  uint16_t value = read_mem16(state, state->sp);
+  state->sp += 2;
+  return value;
+}
+
+void attach_in(State8080 *state, uint8_t port,
+               uint8_t (*in)(void *device, uint8_t port), void *device) {
+  // Makes IN from `port` call `in`
+  state->ports[port].in = in;
+  state->ports[port].in_device = device;
+}
+
+void attach_out(State8080 *state, uint8_t port,
+                void (*out)(void *device, uint8_t port, uint8_t value),
+                void *device) {
+  // Makes OUT to `port` call `out`
+  state->ports[port].out = out;
+  state->ports[port].out_device = device;
+}
+
+static inline uint8_t port_in(State8080 *state, uint8_t port) {
+  const Port8080 *p = &state->ports[port];
+  return p->in != NULL ? p->in(p->in_device, port) : 0;
+}
+
+static inline void port_out(State8080 *state, uint8_t port, uint8_t value) {
+  const Port8080 *p = &state->ports[port];
+  if (p->out != NULL)
+    p->out(p->out_device, port, value);
+}
+
+int schedule(State8080 *state, uint64_t when,
+             void (*fire)(State8080 *state, void *device, uint64_t when),
+             void *device) {
+  // Queues `fire` for cycle `when` of the run_until() clock. Returns 0 if
+  // EVENTS_MAX events are already pending.
+  Events8080 *q = &state->events;
+  if (q->count == EVENTS_MAX)
+    return 0;
+  int i = q->count++;
+  while (i > 0 && q->heap[(i - 1) / 2].when > when) {
+    q->heap[i] = q->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  q->heap[i] = (Event8080){when, fire, device};
+  return 1;
+}
+
+static Event8080 next_event(State8080 *state) {
+  // Takes the earliest event off the heap, which must not be empty
+  Events8080 *q = &state->events;
+  Event8080 first = q->heap[0];
+  Event8080 last = q->heap[--q->count];
+  int i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= q->count)
+      break;
+    if (child + 1 < q->count && q->heap[child + 1].when < q->heap[child].when)
+      child++;
+    if (last.when <= q->heap[child].when)
+      break;
+    q->heap[i] = q->heap[child];
+    i = child;
+  }
+  q->heap[i] = last;
+  return first;
+}
+
+int interrupt8080(State8080 *state, uint8_t rst) {
+  // Takes an interrupt that puts RST `rst` on the bus: pushes the pc of the
+  // next instruction, not past it as the RST opcode does, and jumps to
+  // rst * 8. Returns the cycles that took, 0 if interrupts were disabled
+  // and it was dropped.
+  if (!state->int_enable)
+    return 0;
+  state->int_enable = 0;
+  uint16_t pc = state->pc;
+  if (state->halted) {
+    pc++; // the HLT is done
+    state->halted = 0;
+  }
+  write_mem(state, (uint16_t)(state->sp - 1), pc >> 8);
+  write_mem(state, (uint16_t)(state->sp - 2), pc & 0xff);
+  state->sp -= 2;
+  state->pc = rst * 8;
+  return cycles8080[0xc7];
+}
+
+// Space Invaders board. Besides the CPU it has a 16-bit shift register
+// that the game uses to draw sprites at any pixel offset, the controls on
+// input ports 0-2, and sound and watchdog latches on the output ports.
+#define INVADERS_COIN 0x01     // port 1
+#define INVADERS_P2_START 0x02 // port 1
+#define INVADERS_P1_START 0x04 // port 1
+#define INVADERS_FIRE 0x10     // ports 1 (player 1) and 2 (player 2)
+#define INVADERS_LEFT 0x20
+#define INVADERS_RIGHT 0x40
+typedef struct Invaders {
+  uint8_t inputs[3];    // what ports 0-2 read, hosts set the INVADERS_* bits
+  uint16_t shift;       // last two bytes written to port 4, newest on top
+  uint8_t shift_offset; // port 2, how far port 3 reads from the top
+  uint8_t sound[2];     // last writes to ports 3 and 5
+  uint8_t watchdog;     // last write to port 6
+} Invaders;
+
+static uint8_t invaders_inputs(void *device, uint8_t port) {
+  return ((Invaders *)device)->inputs[port];
+}
+
+static uint8_t invaders_shift_in(void *device, uint8_t port) {
+  // Port 3: 8 bits of the shift register, shift_offset bits from the top
+  Invaders *inv = device;
+  (void)port;
+  return (uint8_t)(inv->shift >> (8 - inv->shift_offset));
+}
+
+static void invaders_shift_offset(void *device, uint8_t port, uint8_t value) {
+  (void)port;
+  ((Invaders *)device)->shift_offset = value & 7;
+}
+
+static void invaders_shift_data(void *device, uint8_t port, uint8_t value) {
+  // Port 4: the byte written becomes the top half, the old top moves down
+  Invaders *inv = device;
+  (void)port;
+  inv->shift = (uint16_t)(value << 8 | inv->shift >> 8);
+}
+
+static void invaders_sound(void *device, uint8_t port, uint8_t value) {
+  ((Invaders *)device)->sound[port == 5] = value;
+}
+
+static void invaders_watchdog(void *device, uint8_t port, uint8_t value) {
+  (void)port;
+  ((Invaders *)device)->watchdog = value;
+}
+
+// The video hardware interrupts with RST 1 when the beam reaches the middle
+// of the screen and RST 2 at the start of vertical blank, once a frame each
+static void invaders_mid_screen(State8080 *state, void *device,
+                                uint64_t when) {
+  state->events.now += interrupt8080(state, 1);
+  schedule(state, when + CYCLES_PER_FRAME, invaders_mid_screen, device);
+}
+
+static void invaders_vblank(State8080 *state, void *device, uint64_t when) {
+  state->events.now += interrupt8080(state, 2);
+  schedule(state, when + CYCLES_PER_FRAME, invaders_vblank, device);
+}
+
+Invaders *machine_init(State8080 *state) {
+  // Lays out the Space Invaders memory map (8K of ROM, 8K of RAM whose top
+  // 7K is the screen, and that RAM again all the way up) and attaches the
+  // board's ports. Returns the board for the host to feed input to, NULL
+  // if it cannot be allocated.
+  Invaders *inv = calloc(1, sizeof(Invaders));
+  if (inv == NULL)
+    return NULL;
+  // Bits the board wires high. Port 2 left at 0 sets the DIP switches to 3
+  // ships, extra ship at 1500.
+  inv->inputs[0] = 0x0e;
+  inv->inputs[1] = 0x08;
+  map_rom(state, 0x0000, 0x2000);
+  for (uint32_t mirror = 0x4000; mirror < 0x10000; mirror += 0x2000)
+    map_mirror(state, mirror, 0x2000, 0x2000);
+  map_video(state, VRAM_START, VRAM_SIZE);
+  for (int port = 0; port < 3; port++)
+    attach_in(state, port, invaders_inputs, inv);
+  attach_in(state, 3, invaders_shift_in, inv);
+  attach_out(state, 2, invaders_shift_offset, inv);
+  attach_out(state, 3, invaders_sound, inv);
+  attach_out(state, 4, invaders_shift_data, inv);
+  attach_out(state, 5, invaders_sound, inv);
+  attach_out(state, 6, invaders_watchdog, inv);
+  uint64_t frame = state->events.now;
+  schedule(state, frame + CYCLES_PER_HALF_FRAME, invaders_mid_screen, inv);
+  schedule(state, frame + CYCLES_PER_FRAME, invaders_vblank, inv);
+  return inv;
+}
+
+// Headless frame capture (-c). Each finished frame goes on the emulation
+// thread into a free slot of a ring, and a writer thread empties the ring
+// into the file: a raw Y4M (8-bit, the overlay's luma) or PPM stream, or a
+// recording of the VRAM itself (see VIDEO_RECORD_MAGIC). The emulation
+// thread never waits on the writer or the file: with the ring full, the
+// frame is dropped and counted.
+#define CAPTURE_SLOTS 8 // a power of two
+#define CAPTURE_IDLE_NS 1000000
+
+enum { CAPTURE_PPM, CAPTURE_Y4M, CAPTURE_RECORD };
+
+typedef struct Capture {
+  FILE *out;
+  int format; // CAPTURE_*
+  size_t frame_bytes;
+  uint8_t *slots[CAPTURE_SLOTS];
+  uint32_t numbers[CAPTURE_SLOTS]; // frame number in each slot
+  // Frames handed over and written so far, slot n % CAPTURE_SLOTS. Only
+  // the emulation thread moves head and only the writer moves tail.
+  _Atomic uint32_t head;
+  _Atomic uint32_t tail;
+  _Atomic int done;
+  int failed; // the writer had no buffers or could not write, read after
+              // it is joined
+  pthread_t writer;
+  // Emulation thread side: the screen as of the last frame, so that only
+  // what take_video_dirty() reports has to be converted again
+  ScreenRows rows;
+  uint8_t *frame;
+  uint32_t *rgba_overlay;
+  uint8_t *gray_overlay;
+  uint64_t frames, dropped, unchanged;
+  int missed; // a frame was dropped since the last one handed over
+} Capture;
+
+// The writer's side of a recording
+typedef struct Recorder {
+  uint8_t last[VRAM_SIZE]; // frame of the last record
+  uint8_t delta[VRAM_SIZE];
+  uint8_t coded[VIDEO_RECORD_HEAD + VIDEO_RLE_BOUND(VRAM_SIZE)];
+  uint32_t last_key;
+  int started;
+} Recorder;
+
+static int capture_record(Capture *cap, Recorder *rec, const uint8_t *vram,
+                          uint32_t number) {
+  // Writes one record, returns 0 on a write error
+  const uint8_t *from = vram;
+  uint8_t type = VIDEO_RECORD_DELTA;
+  if (!rec->started || number - rec->last_key >= VIDEO_KEY_INTERVAL) {
+    type = VIDEO_RECORD_KEY;
+    rec->last_key = number;
+    rec->started = 1;
+  } else {
+    for (int i = 0; i < VRAM_SIZE; i++)
+      rec->delta[i] = vram[i] ^ rec->last[i];
+    from = rec->delta;
+  }
+  memcpy(rec->last, vram, VRAM_SIZE);
+  size_t len =
+      video_rle_encode(from, VRAM_SIZE, rec->coded + VIDEO_RECORD_HEAD);
+  rec->coded[0] = type;
+  video_put32(rec->coded + 1, number);
+  video_put32(rec->coded + 5, (uint32_t)len);
+  return fwrite(rec->coded, VIDEO_RECORD_HEAD + len, 1, cap->out) == 1;
+}
+
+static int capture_write(Capture *cap, Recorder *rec, int slot,
+                         uint8_t *rgb) {
+  // One frame of the stream, returns 0 on a write error
+  const uint8_t *frame = cap->slots[slot];
+  if (cap->format == CAPTURE_RECORD)
+    return capture_record(cap, rec, frame, cap->numbers[slot]);
+  if (cap->format == CAPTURE_Y4M)
+    return video_write_y4m(cap->out, frame);
+  return video_write_ppm(cap->out, (const uint32_t *)frame, rgb);
+}
+
+static void *capture_writer(void *arg) {
+  Capture *cap = arg;
+  uint8_t *rgb = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 3);
+  Recorder *rec = calloc(1, sizeof(Recorder));
+  // Without its buffers the capture fails, but the ring is still drained
+  // so that the emulation thread goes on handing frames over
+  if (rgb == NULL || rec == NULL)
+    cap->failed = 1;
+  const struct timespec idle = {0, CAPTURE_IDLE_NS};
+  for (;;) {
+    uint32_t tail = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&cap->head, memory_order_acquire)) {
+      // done is set after the last frame was handed over
+      if (atomic_load_explicit(&cap->done, memory_order_acquire) &&
+          tail == atomic_load_explicit(&cap->head, memory_order_acquire))
+        break;
+      nanosleep(&idle, NULL);
+      continue;
+    }
+    if (!cap->failed && !capture_write(cap, rec, tail % CAPTURE_SLOTS, rgb))
+      cap->failed = 1;
+    atomic_store_explicit(&cap->tail, tail + 1, memory_order_release);
+  }
+  if (cap->format == CAPTURE_RECORD && !cap->failed) {
+    uint8_t end[VIDEO_RECORD_HEAD] = {VIDEO_RECORD_END};
+    video_put32(end + 1, (uint32_t)cap->frames);
+    if (fwrite(end, sizeof(end), 1, cap->out) != 1)
+      cap->failed = 1;
+  }
+  free(rec);
+  free(rgb);
+  return NULL;
+}
+
+static void capture_free(Capture *cap) {
+  for (int i = 0; i < CAPTURE_SLOTS; i++)
+    free(cap->slots[i]);
+  free(cap->frame);
+  free(cap->rgba_overlay);
+  free(cap->gray_overlay);
+  free(cap);
+}
+
+static int ends_with(const char *s, const char *suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+Capture *capture_open(const char *path) {
+  // Starts a capture to `path`: a recording if it ends in .v80, Y4M if in
+  // .y4m and PPM otherwise. Returns NULL if the buffers, the file or the
+  // writer thread cannot be had.
+  Capture *cap = calloc(1, sizeof(Capture));
+  if (cap == NULL)
+    return NULL;
+  cap->format = ends_with(path, ".v80")   ? CAPTURE_RECORD
+                : ends_with(path, ".y4m") ? CAPTURE_Y4M
+                                          : CAPTURE_PPM;
+  cap->frame_bytes = cap->format == CAPTURE_RECORD ? VRAM_SIZE
+                     : cap->format == CAPTURE_Y4M
+                         ? SCREEN_WIDTH * SCREEN_HEIGHT
+                         : SCREEN_WIDTH * SCREEN_HEIGHT * 4;
+  // The buffers come first so that running out of memory leaves no empty
+  // file behind
+  int ok = 1;
+  for (int i = 0; i < CAPTURE_SLOTS; i++)
+    ok &= (cap->slots[i] = malloc(cap->frame_bytes)) != NULL;
+  ok &= (cap->frame = malloc(cap->frame_bytes)) != NULL;
+  if (cap->format == CAPTURE_Y4M)
+    ok &= (cap->gray_overlay = malloc(SCREEN_WIDTH * SCREEN_HEIGHT)) != NULL;
+  else if (cap->format == CAPTURE_PPM)
+    ok &= (cap->rgba_overlay = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4)) !=
+          NULL;
+  if (!ok) {
+    capture_free(cap);
+    return NULL;
+  }
+  cap->out = fopen(path, "wb");
+  if (cap->out == NULL) {
+    capture_free(cap);
+    return NULL;
+  }
+  setvbuf(cap->out, NULL, _IOFBF, 1 << 20);
+  if (cap->format == CAPTURE_RECORD) {
+    uint8_t header[VIDEO_RECORD_HEADER] = {'V', '8', '0', 'R',
+                                           VIDEO_RECORD_VERSION,
+                                           VRAM_SIZE & 0xff, VRAM_SIZE >> 8};
+    fwrite(header, sizeof(header), 1, cap->out);
+  } else if (cap->format == CAPTURE_Y4M) {
+    video_overlay_invaders(NULL, cap->gray_overlay);
+    video_write_y4m_header(cap->out);
+  } else {
+    video_overlay_invaders(cap->rgba_overlay, NULL);
+  }
+  if (pthread_create(&cap->writer, NULL, capture_writer, cap) != 0) {
+    fclose(cap->out);
+    capture_free(cap);
+    return NULL;
+  }
+  return cap;
+}
+
+void capture_frame(Capture *cap, State8080 *state) {
+  // Hands the frame now in video memory to the writer, or drops it. A
+  // recording leaves out frames the same as the one before.
+  VideoDirty dirty;
+  uint32_t groups = take_video_dirty(state, &dirty);
+  const uint8_t *vram = state->memory + state->video_start;
+  uint64_t number = cap->frames++;
+  if (cap->format == CAPTURE_RECORD) {
+    if (groups == 0 && !cap->missed && number != 0) {
+      cap->unchanged++;
+      return;
+    }
+  } else if (groups != 0) {
+    video_rows(vram, cap->rows, groups);
+    const uint8_t(*rows)[SCREEN_ROW_BYTES] = cap->rows;
+    if (cap->format == CAPTURE_Y4M)
+      video_gray(rows, cap->gray_overlay, groups, cap->frame);
+    else
+      video_rgba(rows, cap->rgba_overlay, groups, (uint32_t *)cap->frame);
+  }
+  uint32_t head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&cap->tail, memory_order_acquire) ==
+      CAPTURE_SLOTS) {
+    cap->dropped++;
+    cap->missed = 1;
+    return;
+  }
+  memcpy(cap->slots[head % CAPTURE_SLOTS],
+         cap->format == CAPTURE_RECORD ? vram : cap->frame, cap->frame_bytes);
+  cap->numbers[head % CAPTURE_SLOTS] = (uint32_t)number;
+  cap->missed = 0;
+  atomic_store_explicit(&cap->head, head + 1, memory_order_release);
+}
+
+int capture_close(Capture *cap) {
+  // Lets the writer finish what it was handed and reports what was
+  // dropped. Returns 0 if the stream could not be written.
+  atomic_store_explicit(&cap->done, 1, memory_order_release);
+  pthread_join(cap->writer, NULL);
+  int ok = !cap->failed && fclose(cap->out) == 0;
+  printf("capture: %llu frames, %llu written, %llu dropped",
+         (unsigned long long)cap->frames,
+         (unsigned long long)(cap->frames - cap->dropped - cap->unchanged),
+         (unsigned long long)cap->dropped);
+  if (cap->format == CAPTURE_RECORD)
+    printf(", %llu unchanged", (unsigned long long)cap->unchanged);
+  printf("%s\n", ok ? "" : ", write error");
+  capture_free(cap);
+  return ok;
+}
+
+#ifdef JIT
+// Dynamic recompiler (-DJIT, x86-64 only). Blocks that have been entered
+// JIT_THRESHOLD times are translated into native code in an mmap'd buffer.
+// Inside a block the 8080 registers live in host registers:
+//
+//	al = A        ch:cl = BC    dh:dl = DE    bh:bl = HL
+//	r9 = SP       ebp = flags in PSW layout   rsi = guest memory
+//	rdi = State8080, r8/r10/r11 scratch
+//
+// so register pairs index memory directly as [rsi+rbx]. A compiled block is
+// called as `int f(State8080 *)`, writes every register, the flags and pc
+// back and returns the cycles it used. Blocks using an opcode the translator
+// does not know stay interpreted, and loads or stores that would take
+// read_mem()'s or write_mem()'s slow path leave the block before the
+// instruction, for the interpreter to carry out.
+#if !defined(__x86_64__) || !defined(__GNUC__)
+#error "JIT needs an x86-64 host and GCC/Clang"
+#endif
+#define JIT_BLOCK_MAX_BYTES 8192 // worst case for a BLOCK_MAX_INSTS block
+
+// Exits taken from the middle of a block, emitted after its body
+typedef struct JitStub {
+  uint8_t *patch;   // rel32 of the branch to the stub
+  uint16_t pc;      // where the interpreter carries on
+  uint16_t cycles;  // cycles used up to that point
+} JitStub;
+
+typedef struct JitEmit {
+  uint8_t *p;
+  uint8_t *epilogue;
+  JitStub stubs[2 * BLOCK_MAX_INSTS];
+  int nstubs;
+} JitEmit;
+
+// Host register numbers of B, C, D, E, H, L, (M), A
+static const uint8_t jit_reg8[8] = {5, 1, 6, 2, 7, 3, 0xff, 0};
+// Flag tested by each condition (NZ Z NC C PO PE P M), odd ones want it set
+static const uint8_t jit_cond_flag[8] = {FLAG_Z,  FLAG_Z,  FLAG_CY, FLAG_CY,
+                                         FLAG_P,  FLAG_P,  FLAG_S,  FLAG_S};
+
+#define JIT_OFF(field) ((uint32_t)offsetof(State8080, field))
+
+static void jit_bytes(JitEmit *e, int n, ...) {
+  va_list ap;
+  va_start(ap, n);
+  while (n--)
+    *e->p++ = (uint8_t)va_arg(ap, int);
+  va_end(ap);
+}
+
+static void jit_u16(JitEmit *e, uint16_t v) {
+  memcpy(e->p, &v, 2);
+  e->p += 2;
+}
+
+static void jit_u32(JitEmit *e, uint32_t v) {
+  memcpy(e->p, &v, 4);
+  e->p += 4;
+}
+
+static void jit_field(JitEmit *e, int reg, uint32_t offset) {
+  // ModRM for [rdi + disp32], the state field at `offset`
+  jit_bytes(e, 1, 0x87 | (reg & 7) << 3);
+  jit_u32(e, offset);
+}
+
+static void jit_patch(uint8_t *patch, uint8_t *target) {
+  int32_t rel = (int32_t)(target - (patch + 4));
+  memcpy(patch, &rel, 4);
+}
+
+static uint8_t *jit_jcc(JitEmit *e, uint8_t cc) {
+  // Emits a jcc rel32 (cc 0x84 = je, 0x85 = jne), returns the rel32 to patch
+  jit_bytes(e, 2, 0x0f, cc);
+  uint8_t *patch = e->p;
+  jit_u32(e, 0);
+  return patch;
+}
+
+static void jit_stub(JitEmit *e, uint8_t *patch, uint16_t pc, int cycles) {
+  JitStub *s = &e->stubs[e->nstubs++];
+  s->patch = patch;
+  s->pc = pc;
+  s->cycles = cycles;
+}
+
+static void jit_exit(JitEmit *e, uint16_t pc, int cycles) {
+  // mov r8d, pc; mov r10d, cycles; jmp epilogue
+  jit_bytes(e, 2, 0x41, 0xb8);
+  jit_u32(e, pc);
+  jit_bytes(e, 2, 0x41, 0xba);
+  jit_u32(e, cycles);
+  jit_bytes(e, 1, 0xe9);
+  uint8_t *patch = e->p;
+  jit_u32(e, 0);
+  jit_patch(patch, e->epilogue);
+}
+
+static void jit_page_test(JitEmit *e, uint8_t mask, uint16_t pc, int cycles) {
+  // Leaves the block before the instruction at `pc` if the page of the
+  // address in r11d has any of `mask`: shr r11d, 8;
+  // test byte [rdi + r11 + pages], mask; jnz stub
+  jit_bytes(e, 4, 0x41, 0xc1, 0xeb, 0x08);
+  jit_bytes(e, 4, 0x42, 0xf6, 0x84, 0x1f);
+  jit_u32(e, JIT_OFF(pages));
+  jit_bytes(e, 1, mask);
+  jit_stub(e, jit_jcc(e, 0x85), pc, cycles);
+}
+
+static void jit_check_mem(JitEmit *e, int reg, uint8_t mask, uint16_t pc,
+                          int cycles) {
+  // Before an access through BC (reg 1), DE (2) or HL (3):
+  // mov r11d, ecx/edx/ebx
+  jit_bytes(e, 3, 0x41, 0x89, 0xc3 | reg << 3);
+  jit_page_test(e, mask, pc, cycles);
+}
+
+static void jit_check_stack(JitEmit *e, int from, uint8_t mask, uint16_t pc,
+                            int cycles) {
+  // Before an access to the stack bytes at SP + from and SP + from + 1:
+  // lea r11d, [r9 + offset]; movzx r11d, r11w, then the page test
+  for (int i = 0; i < 2; i++) {
+    jit_bytes(e, 4, 0x45, 0x8d, 0x59, (uint8_t)(from + i));
+    jit_bytes(e, 4, 0x45, 0x0f, 0xb7, 0xdb);
+    jit_page_test(e, mask, pc, cycles);
   }
+}
+
+static void jit_flags_alu(JitEmit *e, int sub) {
+  // lahf; movzx ebp, ah; and ebp, mask. x86 sets AF on a borrow out of bit 3
+  // where the 8080 sets AC on the carry of the complement add, so
+  // subtractions flip it.
+  jit_bytes(e, 1, 0x9f);
+  jit_bytes(e, 3, 0x0f, 0xb6, 0xec);
+  jit_bytes(e, 3, 0x83, 0xe5, FLAGS_PSW);
+  if (sub)
+    jit_bytes(e, 3, 0x83, 0xf5, FLAG_AC);
+}
+
+static void jit_flags_inr(JitEmit *e, int dcr) {
+  // As jit_flags_alu() but CY is kept: lahf; mov r8d, eax; shr r8d, 8;
+  // and r8d, mask & ~CY; (xor r8d, AC); and ebp, CY; or ebp, r8d
+  jit_bytes(e, 1, 0x9f);
+  jit_bytes(e, 3, 0x41, 0x89, 0xc0);
+  jit_bytes(e, 4, 0x41, 0xc1, 0xe8, 0x08);
+  jit_bytes(e, 4, 0x41, 0x83, 0xe0, FLAGS_PSW & ~FLAG_CY);
+  if (dcr)
+    jit_bytes(e, 4, 0x41, 0x83, 0xf0, FLAG_AC);
+  jit_bytes(e, 3, 0x83, 0xe5, FLAG_CY);
+  jit_bytes(e, 3, 0x44, 0x09, 0xc5);
+}
+
+static void jit_carry(JitEmit *e) {
+  // CY from CF, the other flags kept: setc r8b; movzx r8d, r8b;
+  // and ebp, ~CY; or ebp, r8d
+  jit_bytes(e, 4, 0x41, 0x0f, 0x92, 0xc0);
+  jit_bytes(e, 4, 0x45, 0x0f, 0xb6, 0xc0);
+  jit_bytes(e, 3, 0x83, 0xe5, (uint8_t)~FLAG_CY);
+  jit_bytes(e, 3, 0x44, 0x09, 0xc5);
+}
+
+// Operand of an ALU instruction: a host register, [rsi+rbx] or an imm8
+enum { JIT_SRC_REG, JIT_SRC_MEM, JIT_SRC_IMM };
+
+static void jit_operand(JitEmit *e, uint8_t op, int reg, int kind,
+                        uint8_t src) {
+  // `op` with the r/m8 operand and the register `reg` (0 = al, 4 = ah),
+  // op's reg, r/m form (+2 for the load form, +4 for the al, imm8 form)
+  if (kind == JIT_SRC_REG)
+    jit_bytes(e, 2, op, 0xc0 | src << 3 | reg);
+  else if (kind == JIT_SRC_MEM)
+    jit_bytes(e, 3, op + 2, 0x04 | reg << 3, 0x1e);
+  else if (reg == 0)
+    jit_bytes(e, 2, op + 4, src);
+  else
+    jit_bytes(e, 3, 0x80, 0xc0 | (op >> 3) << 3 | reg, src);
+}
+
+static void jit_alu(JitEmit *e, int group, int kind, uint8_t src,
+                    int flags) {
+  // ADD ADC SUB SBB ANA XRA ORA CMP on al, leaving the flags alone unless
+  // `flags`. x86 leaves AF undefined after the logical ones: XRA and ORA
+  // clear AC, ANA sets it to bit 3 of the operands' OR, worked out in ah
+  // first: mov ah, al; or ah, src; op; mov r8d, eax; then lahf and r8d's
+  // bit 11 moved to AC
+  static const uint8_t alu_op[8] = {0x00, 0x10, 0x28, 0x18,
+                                    0x20, 0x30, 0x08, 0x38};
+  if (group == 1 || group == 3)
+    jit_bytes(e, 4, 0x0f, 0xba, 0xe5, 0x00); // bt ebp, 0 (CY -> CF)
+  if (group == 4 && flags) {
+    jit_bytes(e, 2, 0x88, 0xc4);
+    jit_operand(e, 0x08, 4, kind, src);
+  }
+  jit_operand(e, alu_op[group], 0, kind, src);
+  if (!flags)
+    return;
+  if (group < 4 || group == 7) {
+    jit_flags_alu(e, group >= 2);
+    return;
+  }
+  if (group == 4)
+    jit_bytes(e, 3, 0x41, 0x89, 0xc0);
+  jit_bytes(e, 1, 0x9f);
+  jit_bytes(e, 3, 0x0f, 0xb6, 0xec);
+  jit_bytes(e, 3, 0x83, 0xe5, FLAGS_PSW & ~FLAG_AC);
+  if (group == 4) {
+    jit_bytes(e, 4, 0x41, 0xc1, 0xe8, 0x07); // shr r8d, 7
+    jit_bytes(e, 4, 0x41, 0x83, 0xe0, FLAG_AC);
+    jit_bytes(e, 3, 0x44, 0x09, 0xc5);
+  }
+}
+
+static void jit_check_addr(JitEmit *e, uint16_t addr, uint8_t mask,
+                           uint16_t pc, int cycles) {
+  // Before an access to a fixed address: mov r11d, addr; the page test
+  jit_bytes(e, 2, 0x41, 0xbb);
+  jit_u32(e, addr);
+  jit_page_test(e, mask, pc, cycles);
+}
 
+static uint8_t jit_flags_read(uint8_t op) {
+  // Flags `op` reads, the other side of flags8080[]
+  if ((op & 0xc7) == 0xc0 || (op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4)
+    return jit_cond_flag[(op >> 3) & 7];
+  if ((op & 0xf0) == 0x80 || (op & 0xf0) == 0x90)
+    return op & 0x08 ? FLAG_CY : 0; // ADC SBB
+  switch (op) {
+  case 0xce: // ACI
+  case 0xde: // SBI
+  case 0x17: // RAL
+  case 0x1f: // RAR
+  case 0x3f: // CMC
+    return FLAG_CY;
+  case 0x27: // DAA
+    return FLAG_AC | FLAG_CY;
+  case 0xf5: // PUSH PSW
+    return FLAGS_PSW;
+  }
   return 0;
 }
 
-int disassemble(unsigned char *buffer, int pc) {
-  // Performs actual disassembly of 8080 Machine Code
-  // Params:
-  //	unsigned char *buffer - Buffer containing the machine code
-  //	int pc - Program Counter
-  //
-  // Returns:
-  //	int - New Program Counter Location
-
-  unsigned char *opcode = &buffer[pc];
-  int opbytes = 1;
-  printf("%04x ", pc);
-  switch (*opcode) {
-  case 0x00:
-    printf("NOP");
-    break;
-  case 0x01:
-    printf("LXI\tB, #$0x%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0x02:
-    printf("STAX\tB");
-    break;
-  case 0x03:
-    printf("INX\tB");
-    break;
-  case 0x04:
-    printf("INR\tB");
-    break;
-  case 0x05:
-    printf("DCR\tB");
-    break;
-  case 0x06:
-    printf("MVI\tB, #$0x%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0x07:
-    printf("RLC");
-    break;
-  case 0x09:
-    printf("DAD\tB");
-    break;
-  case 0x0a:
-    printf("LDAX\tB");
-    break;
-  case 0x0b:
-    printf("DCX\tB");
-    break;
-  case 0x0c:
-    printf("INR\tC");
-    break;
-  case 0x0d:
-    printf("DCR\tC");
-    break;
-  case 0x0e:
-    printf("MVI\tC, #$0x%02x", opcode[1]);
-    opbytes = 2;
-    break;
+static int jit_register_only(uint8_t op) {
+  // Whether the translation of `op` never leaves the block before it, for
+  // the interpreter to see the flags: nothing but registers change
+  if (op >= 0x40 && op <= 0x7f)
+    return (op & 7) != 6 && (op & 0x38) != 0x30; // MOV r, r
+  if (op >= 0x80 && op <= 0xbf)
+    return (op & 7) != 6; // ALU r
+  if ((op & 0xc6) == 0x04 || (op & 0xc7) == 0x06)
+    return (op & 0x38) != 0x30; // INR DCR MVI r
+  if ((op & 0xc7) == 0xc6 || (op & 0xc7) == 0x00 || (op & 0xcf) == 0x01 ||
+      (op & 0xc7) == 0x03 || (op & 0xcf) == 0x09)
+    return 1; // ALU imm, NOP, LXI, INX, DCX, DAD
+  switch (op) {
+  case 0x07: // RLC RRC RAL RAR
   case 0x0f:
-    printf("RRC");
-    break;
-  case 0x10:
-    break;
-  case 0x11:
-    printf("LXI\tD, #$0x%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0x12:
-    printf("STAX\tD");
-    break;
-  case 0x13:
-    printf("INX\tD");
-    break;
-  case 0x14:
-    printf("INR\tD");
-    break;
-  case 0x15:
-    printf("DCR\tD");
-    break;
-  case 0x16:
-    printf("MVI\tD, #$0x%02x", opcode[1]);
-    opbytes = 2;
-    break;
   case 0x17:
-    printf("RAL");
-    break;
-  case 0x18:
-    break;
-  case 0x19:
-    printf("DAD\tD");
-    break;
-  case 0x1a:
-    printf("LDAX\tD");
-    break;
-  case 0x1b:
-    printf("DCX\tD");
-    break;
-  case 0x1c:
-    printf("INR\tE");
-    break;
-  case 0x1d:
-    printf("DCR\tE");
-    break;
-  case 0x1e:
-    printf("MVI\tE, #$0x%02x", opcode[1]);
-    opbytes = 2;
-    break;
   case 0x1f:
-    printf("RAR");
-    break;
-  case 0x20:
-    break;
-  case 0x21:
-    printf("LXI\tH, #$0x%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0x22:
-    printf("SHLD\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0x23:
-    printf("INX\tH");
-    break;
-  case 0x24:
-    printf("INR\tH");
-    break;
-  case 0x25:
-    printf("DCR\tH");
-    break;
-  case 0x26:
-    printf("MVI\tH, #$0x%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0x27:
-    printf("DAA");
-    break;
-  case 0x28:
-    break;
-  case 0x29:
-    printf("DAD\tH");
-    break;
-  case 0x2a:
-    printf("LHLD\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0x2b:
-    printf("DCX\tH");
-    break;
-  case 0x2c:
-    printf("INR\tL");
-    break;
-  case 0x2d:
-    printf("DCR\tL");
-    break;
-  case 0x2e:
-    printf("MVI\tL, #$0x%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0x2f:
-    printf("CMA");
-    break;
-  case 0x30:
-    break;
-  case 0x31:
-    printf("LXI\tSP, #$0x%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0x32:
-    printf("STA\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0x33:
-    printf("INX\tSP");
-    break;
-  case 0x34:
-    printf("INR\tM");
-    break;
-  case 0x35:
-    printf("DCR\tM");
-    break;
-  case 0x36:
-    printf("MVI\tM, #$0x%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0x37:
-    printf("STC");
-    break;
-  case 0x38:
-    break;
-  case 0x39:
-    printf("DAD\tSP");
-    break;
-  case 0x3a:
-    printf("LDA\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0x3b:
-    printf("DCX\tSP");
-    break;
-  case 0x3c:
-    printf("INR\tA");
-    break;
-  case 0x3d:
-    printf("DCR\tA");
-    break;
-  case 0x3e:
-    printf("MVI\tA, #$0x%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0x3f:
-    printf("CMC");
-    break;
-  case 0x40:
-    printf("MOV\tB, B");
-    break;
-  case 0x41:
-    printf("MOV\tB, C");
-    break;
-  case 0x42:
-    printf("MOV\tB, D");
-    break;
-  case 0x43:
-    printf("MOV\tB, E");
-    break;
-  case 0x44:
-    printf("MOV\tB, H");
-    break;
-  case 0x45:
-    printf("MOV\tB, L");
-    break;
-  case 0x46:
-    printf("MOV\tB, M");
-    break;
-  case 0x47:
-    printf("MOV\tB, A");
-    break;
-  case 0x48:
-    printf("MOV\tC, B");
-    break;
-  case 0x49:
-    printf("MOV\tC, C");
-    break;
-  case 0x4a:
-    printf("MOV\tC, D");
-    break;
-  case 0x4b:
-    printf("MOV\tC, E");
-    break;
-  case 0x4c:
-    printf("MOV\tC, F");
-    break;
-  case 0x4d:
-    printf("MOV\tC, L");
-    break;
-  case 0x4e:
-    printf("MOV\tC, M");
-    break;
-  case 0x4f:
-    printf("MOV\tC, A");
-    break;
-  case 0x50:
-    printf("MOV\tD, B");
-    break;
-  case 0x51:
-    printf("MOV\tD, C");
-    break;
-  case 0x52:
-    printf("MOV\tD, D");
-    break;
-  case 0x53:
-    printf("MOV\tD, E");
-    break;
-  case 0x54:
-    printf("MOV\tD, H");
-    break;
-  case 0x55:
-    printf("MOV\tD, L");
-    break;
-  case 0x56:
-    printf("MOV\tD, M");
-    break;
-  case 0x57:
-    printf("MOV\tD, A");
-    break;
-  case 0x58:
-    printf("MOV\tE, B");
-    break;
-  case 0x59:
-    printf("MOV\tE, C");
-    break;
-  case 0x5a:
-    printf("MOV\tE, D");
-    break;
-  case 0x5b:
-    printf("MOV\tE, E");
-    break;
-  case 0x5c:
-    printf("MOV\tE, H");
-    break;
-  case 0x5d:
-    printf("MOV\tE, L");
-    break;
-  case 0x5e:
-    printf("MOV\tE, M");
-    break;
-  case 0x5f:
-    printf("MOV\tE, A");
-    break;
-  case 0x60:
-    printf("MOV\tH, B");
-    break;
-  case 0x61:
-    printf("MOV\tH, C");
-    break;
-  case 0x62:
-    printf("MOV\tH, D");
-    break;
-  case 0x63:
-    printf("MOV\tH, E");
-    break;
-  case 0x64:
-    printf("MOV\tH, H");
-    break;
-  case 0x65:
-    printf("MOV\tH, L");
-    break;
-  case 0x66:
-    printf("MOV\tH, M");
-    break;
-  case 0x67:
-    printf("MOV\tH, A");
-    break;
-  case 0x68:
-    printf("MOV\tL, B");
-    break;
-  case 0x69:
-    printf("MOV\tL, C");
-    break;
-  case 0x6a:
-    printf("MOV\tL, D");
-    break;
-  case 0x6b:
-    printf("MOV\tL, E");
-    break;
-  case 0x6c:
-    printf("MOV\tL, H");
-    break;
-  case 0x6d:
-    printf("MOV\tL, L");
-    break;
-  case 0x6e:
-    printf("MOV\tL, M");
-    break;
-  case 0x6f:
-    printf("MOV\tL, A");
-    break;
-  case 0x70:
-    printf("MOV\tM, B");
-    break;
-  case 0x71:
-    printf("MOV\tM, C");
-    break;
-  case 0x72:
-    printf("MOV\tM, D");
-    break;
-  case 0x73:
-    printf("MOV\tM, E");
-    break;
-  case 0x74:
-    printf("MOV\tM, H");
-    break;
-  case 0x75:
-    printf("MOV\tM, L");
-    break;
-  case 0x76:
-    printf("HLT");
-    break;
-  case 0x77:
-    printf("MOV\tM, A");
-    break;
-  case 0x78:
-    printf("MOV\tA, B");
-    break;
-  case 0x79:
-    printf("MOV\tA, C");
-    break;
-  case 0x7a:
-    printf("MOV\tA, D");
-    break;
-  case 0x7b:
-    printf("MOV\tA, E");
-    break;
-  case 0x7c:
-    printf("MOV\tA, H");
-    break;
-  case 0x7d:
-    printf("MOV\tA, L");
-    break;
-  case 0x7e:
-    printf("MOV\tA, M");
-    break;
-  case 0x7f:
-    printf("MOV\tA, A");
-    break;
-  case 0x80:
-    printf("ADD\tB");
-    break;
-  case 0x81:
-    printf("ADD\tC");
-    break;
-  case 0x82:
-    printf("ADD\tD");
-    break;
-  case 0x83:
-    printf("ADD\tE");
-    break;
-  case 0x84:
-    printf("ADD\tH");
-    break;
-  case 0x85:
-    printf("ADD\tL");
-    break;
-  case 0x86:
-    printf("ADD\tM");
-    break;
-  case 0x87:
-    printf("ADD\tA");
-    break;
-  case 0x88:
-    printf("ADC\tB");
-    break;
-  case 0x89:
-    printf("ADC\tC");
-    break;
-  case 0x8a:
-    printf("ADC\tD");
-    break;
-  case 0x8b:
-    printf("ADC\tE");
-    break;
-  case 0x8c:
-    printf("ADC\tH");
-    break;
-  case 0x8d:
-    printf("ADC\tL");
-    break;
-  case 0x8e:
-    printf("ADC\tM");
-    break;
-  case 0x8f:
-    printf("ADC\tA");
-    break;
-  case 0x90:
-    printf("SUB\tB");
-    break;
-  case 0x91:
-    printf("SUB\tC");
-    break;
-  case 0x92:
-    printf("SUB\tD");
-    break;
-  case 0x93:
-    printf("SUB\tE");
-    break;
-  case 0x94:
-    printf("SUB\tH");
-    break;
-  case 0x95:
-    printf("SUB\tL");
-    break;
-  case 0x96:
-    printf("SUB\tM");
-    break;
-  case 0x97:
-    printf("SUB\tA");
-    break;
-  case 0x98:
-    printf("SBB\tB");
-    break;
-  case 0x99:
-    printf("SBB\tC");
-    break;
-  case 0x9a:
-    printf("SBB\tD");
-    break;
-  case 0x9b:
-    printf("SBB\tE");
-    break;
-  case 0x9c:
-    printf("SBB\tH");
-    break;
-  case 0x9d:
-    printf("SBB\tL");
-    break;
-  case 0x9e:
-    printf("SBB\tM");
-    break;
-  case 0x9f:
-    printf("SBB\tA");
-    break;
-  case 0xa0:
-    printf("ANA\tB");
-    break;
-  case 0xa1:
-    printf("ANA\tC");
-    break;
-  case 0xa2:
-    printf("ANA\tD");
-    break;
-  case 0xa3:
-    printf("ANA\tE");
-    break;
-  case 0xa4:
-    printf("ANA\tH");
-    break;
-  case 0xa5:
-    printf("ANA\tL");
-    break;
-  case 0xa6:
-    printf("ANA\tM");
-    break;
-  case 0xa7:
-    printf("ANA\tA");
-    break;
-  case 0xa8:
-    printf("XRA\tB");
-    break;
-  case 0xa9:
-    printf("XRA\tC");
-    break;
-  case 0xaa:
-    printf("XRA\tD");
-    break;
-  case 0xab:
-    printf("XRA\tE");
-    break;
-  case 0xac:
-    printf("XRA\tH");
-    break;
-  case 0xad:
-    printf("XRA\tL");
-    break;
-  case 0xae:
-    printf("XRA\tM");
-    break;
-  case 0xaf:
-    printf("XRA\tA");
-    break;
-  case 0xb0:
-    printf("ORA\tB");
-    break;
-  case 0xb1:
-    printf("ORA\tC");
-    break;
-  case 0xb2:
-    printf("ORA\tD");
-    break;
-  case 0xb3:
-    printf("ORA\tE");
-    break;
-  case 0xb4:
-    printf("ORA\tH");
-    break;
-  case 0xb5:
-    printf("ORA\tL");
-    break;
-  case 0xb6:
-    printf("ORA\tM");
-    break;
-  case 0xb7:
-    printf("ORA\tA");
-    break;
-  case 0xb8:
-    printf("CMP\tB");
-    break;
-  case 0xb9:
-    printf("CMP\tC");
-    break;
-  case 0xba:
-    printf("CMP\tD");
-    break;
-  case 0xbb:
-    printf("CMP\tE");
-    break;
-  case 0xbc:
-    printf("CMP\tH");
-    break;
-  case 0xbd:
-    printf("CMP\tL");
-    break;
-  case 0xbe:
-    printf("CMP\tM");
-    break;
-  case 0xbf:
-    printf("CMP\tA");
-    break;
-  case 0xc0:
-    printf("RNZ");
-    break;
-  case 0xc1:
-    printf("POP\tB");
-    break;
-  case 0xc2:
-    printf("JNZ\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xc3:
-    printf("JMP\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xc4:
-    printf("CNZ\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xc5:
-    printf("PUSH\tB");
-    break;
-  case 0xc6:
-    printf("ADI\t#$%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0xc7:
-    printf("RST\t0");
-    break;
-  case 0xc8:
-    printf("RZ");
-    break;
-  case 0xc9:
-    printf("RET");
-    break;
-  case 0xca:
-    printf("JZ\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
+  case 0x2f: // CMA
+  case 0x37: // STC
+  case 0x3f: // CMC
+  case 0xeb: // XCHG
+  case 0xf9: // SPHL
+    return 1;
+  }
+  return 0;
+}
+
+static void jit_live_flags(const Block8080 *b, uint8_t *live) {
+  // Flags still wanted after each instruction of `b`. All of them are
+  // wanted at the end of the block and before anything that may leave it
+  // early; a flag that flags8080[] says an instruction sets is dead before
+  // it unless something in between reads it.
+  uint8_t want = FLAGS_PSW;
+  for (int i = b->count - 1; i >= 0; i--) {
+    uint8_t op = b->insts[i].opcode;
+    live[i] = want;
+    want = (want & ~flags8080[op]) | jit_flags_read(op);
+    if (!jit_register_only(op))
+      want = FLAGS_PSW;
+  }
+}
+
+static void jit_cond(JitEmit *e, uint8_t op, uint8_t **not_taken) {
+  // test ebp, flag; then a jump past the taken path when the condition fails
+  int cond = (op >> 3) & 7;
+  jit_bytes(e, 2, 0xf7, 0xc5);
+  jit_u32(e, jit_cond_flag[cond]);
+  *not_taken = jit_jcc(e, cond & 1 ? 0x84 : 0x85);
+}
+
+static void jit_push(JitEmit *e, uint16_t value, uint16_t pc, int cycles) {
+  // Pushes a constant. Page 0 always has PAGE_TAIL, so a push straddling
+  // the end of memory is left to the interpreter with the other slow ones.
+  jit_check_stack(e, -2, 0xff, pc, cycles);
+  jit_bytes(e, 5, 0x66, 0x41, 0x83, 0xe9, 0x02); // sub r9w, 2
+  jit_bytes(e, 5, 0x66, 0x42, 0xc7, 0x04, 0x0e); // mov word [rsi+r9], value
+  jit_u16(e, value);
+}
+
+static void jit_pop_pc(JitEmit *e, uint16_t pc, int cycles) {
+  // movzx r8d, word [rsi+r9]; add r9w, 2. SP = 0xffff reads the tail copy
+  // of address 0.
+  jit_check_stack(e, 0, PAGE_READ_SLOW, pc, cycles);
+  jit_bytes(e, 5, 0x46, 0x0f, 0xb7, 0x04, 0x0e);
+  jit_bytes(e, 5, 0x66, 0x41, 0x83, 0xc1, 0x02);
+}
+
+static void jit_ret_exit(JitEmit *e, int cycles) {
+  // pc is already in r8d: mov r10d, cycles; jmp epilogue
+  jit_bytes(e, 2, 0x41, 0xba);
+  jit_u32(e, cycles);
+  jit_bytes(e, 1, 0xe9);
+  uint8_t *patch = e->p;
+  jit_u32(e, 0);
+  jit_patch(patch, e->epilogue);
+}
+
+static void jit_epilogue(JitEmit *e) {
+  // Writes the host registers back, pc from r8w, returns r10d cycles
+  jit_bytes(e, 1, 0x88);
+  jit_field(e, 0, JIT_OFF(a));
+  jit_bytes(e, 2, 0x66, 0x89);
+  jit_field(e, 1, JIT_OFF(bc)); // mov [rdi+bc], cx
+  jit_bytes(e, 2, 0x66, 0x89);
+  jit_field(e, 2, JIT_OFF(de));
+  jit_bytes(e, 2, 0x66, 0x89);
+  jit_field(e, 3, JIT_OFF(hl));
+  jit_bytes(e, 3, 0x66, 0x44, 0x89);
+  jit_field(e, 1, JIT_OFF(sp));
+  jit_bytes(e, 3, 0x66, 0x44, 0x89);
+  jit_field(e, 0, JIT_OFF(pc));
+  jit_bytes(e, 2, 0x40, 0x88);
+  jit_field(e, 5, JIT_OFF(f)); // mov [rdi+f], bpl
+  jit_bytes(e, 3, 0x44, 0x89, 0xd0);             // mov eax, r10d
+  jit_bytes(e, 5, 0x41, 0x5c, 0x5d, 0x5b, 0xc3); // pop r12/rbp/rbx; ret
+}
+
+static void jit_prologue(JitEmit *e) {
+  jit_bytes(e, 4, 0x53, 0x55, 0x41, 0x54); // push rbx/rbp/r12
+  jit_bytes(e, 2, 0x48, 0x8b);
+  jit_field(e, 6, JIT_OFF(memory)); // mov rsi, [rdi+memory]
+  jit_bytes(e, 2, 0x0f, 0xb6);
+  jit_field(e, 0, JIT_OFF(a)); // movzx eax, byte [rdi+a]
+  jit_bytes(e, 2, 0x0f, 0xb7);
+  jit_field(e, 1, JIT_OFF(bc)); // movzx ecx, word [rdi+bc]
+  jit_bytes(e, 2, 0x0f, 0xb7);
+  jit_field(e, 2, JIT_OFF(de));
+  jit_bytes(e, 2, 0x0f, 0xb7);
+  jit_field(e, 3, JIT_OFF(hl));
+  jit_bytes(e, 3, 0x44, 0x0f, 0xb7);
+  jit_field(e, 1, JIT_OFF(sp)); // movzx r9d, word [rdi+sp]
+  jit_bytes(e, 2, 0x0f, 0xb6);
+  jit_field(e, 5, JIT_OFF(f)); // movzx ebp, byte [rdi+f]
+}
+
+static int jit_supported(uint8_t op) {
+  // Opcodes jit_compile() translates, blocks using any other (DAA, XTHL,
+  // IN, OUT, EI, DI, HLT) stay interpreted
+  if ((op >= 0x40 && op <= 0xbf && op != 0x76) || (op & 0xc6) == 0x04 ||
+      (op & 0xc7) == 0x06 || (op & 0xc7) == 0x00 || (op & 0xc7) == 0x01 ||
+      (op & 0xc7) == 0x03 || (op & 0xc7) == 0xc0 || (op & 0xc7) == 0xc2 ||
+      (op & 0xc7) == 0xc4 || (op & 0xc7) == 0xc6 || (op & 0xc7) == 0xc7 ||
+      (op & 0xcb) == 0xc1)
+    return 1;
+  switch (op) {
+  case 0x02: // STAX
+  case 0x12:
+  case 0x0a: // LDAX
+  case 0x1a:
+  case 0x22: // SHLD
+  case 0x2a: // LHLD
+  case 0x32: // STA
+  case 0x3a: // LDA
+  case 0x07: // RLC RRC RAL RAR
+  case 0x0f:
+  case 0x17:
+  case 0x1f:
+  case 0x2f: // CMA
+  case 0x37: // STC
+  case 0x3f: // CMC
+  case 0xc3: // JMP
   case 0xcb:
-    printf("JMP\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xcc:
-    printf("CZ\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xcd:
-    printf("CALL\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xce:
-    printf("ACI\t#$%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0xcf:
-    printf("RST\t1");
-    break;
-  case 0xd0:
-    printf("RNC");
-    break;
-  case 0xd1:
-    printf("POP\tD");
-    break;
-  case 0xd2:
-    printf("JNC\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xd3:
-    printf("OUT\t#$%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0xd4:
-    printf("CNC\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xd5:
-    printf("PUSH\tD");
-    break;
-  case 0xd6:
-    printf("SUI\t#$%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0xd7:
-    printf("RST\t2");
-    break;
-  case 0xd8:
-    printf("RC");
-    break;
+  case 0xc9: // RET
   case 0xd9:
-    printf("RET");
-    break;
-  case 0xda:
-    printf("JC\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xdb:
-    printf("IN\t#$%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0xdc:
-    printf("CC\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
+  case 0xcd: // CALL
   case 0xdd:
-    printf("CALL\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xde:
-    printf("SBI\t#$%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0xdf:
-    printf("RST\t3");
-    break;
-  case 0xe0:
-    printf("RPO");
-    break;
-  case 0xe1:
-    printf("POP\tH");
-    break;
-  case 0xe2:
-    printf("JPO\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xe3:
-    printf("XTHL");
-    break;
-  case 0xe4:
-    printf("CPO\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xe5:
-    printf("PUSH\tH");
-    break;
-  case 0xe6:
-    printf("ANI\t#$%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0xe7:
-    printf("RST\t4");
-    break;
-  case 0xe8:
-    printf("RPE");
-    break;
-  case 0xe9:
-    printf("PCHL");
-    break;
-  case 0xea:
-    printf("JPE\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xeb:
-    printf("XCHG");
-    break;
-  case 0xec:
-    printf("CPE\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
   case 0xed:
-    printf("CALL\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xee:
-    printf("XRI\t#$%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0xef:
-    printf("RST\t5");
-    break;
-  case 0xf0:
-    printf("RP");
-    break;
-  case 0xf1:
-    printf("POP\tPSW");
-    break;
-  case 0xf2:
-    printf("JP\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xf3:
-    printf("DI");
-    break;
-  case 0xf4:
-    printf("CP\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xf5:
-    printf("PUSH\tPSW");
-    break;
-  case 0xf6:
-    printf("ORI\t#$%02x", opcode[1]);
-    opbytes = 2;
-    break;
-  case 0xf7:
-    printf("RST\t6");
-    break;
-  case 0xf8:
-    printf("RM");
-    break;
-  case 0xf9:
-    printf("SPHL");
-    break;
-  case 0xfa:
-    printf("JM\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xfb:
-    printf("EI");
-    break;
-  case 0xfc:
-    printf("CM\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
   case 0xfd:
-    printf("CALL\t$%02x%02x", opcode[2], opcode[1]);
-    opbytes = 3;
-    break;
-  case 0xfe:
-    printf("CPI\t#$%02x", opcode[1]);
-    opbytes = 2;
+  case 0xe9: // PCHL
+  case 0xeb: // XCHG
+  case 0xf9: // SPHL
+    return 1;
+  }
+  return 0;
+}
+
+static void *jit_compile(State8080 *state, Block8080 *b) {
+  // Translates a block, returns its entry point or NULL if it has an opcode
+  // the translator does not handle or the buffer is full
+  Jit8080 *jit = state->jit;
+  if (JIT_BUFFER_SIZE - jit->used < JIT_BLOCK_MAX_BYTES)
+    return NULL;
+  for (int i = 0; i < b->count; i++)
+    if (!jit_supported(b->insts[i].opcode))
+      return NULL;
+  JitEmit e;
+  e.p = jit->code + jit->used;
+  e.nstubs = 0;
+  e.epilogue = e.p;
+  jit_epilogue(&e);
+  uint8_t *entry = e.p;
+  jit_prologue(&e);
+
+  uint8_t live[BLOCK_MAX_INSTS];
+  jit_live_flags(b, live);
+  uint16_t pc = b->start;
+  int cycles = 0;
+  for (int i = 0; i < b->count; i++) {
+    Decoded8080 *d = &b->insts[i];
+    uint8_t op = d->opcode;
+    uint16_t next = pc + d->len;
+    int before = cycles;
+    cycles += d->cycles;
+    // Whether any flag the instruction sets is still wanted after it
+    int flags = (live[i] & flags8080[op]) != 0;
+    if (flags8080[op] && !flags)
+      jit->dead_flags++;
+    uint8_t *not_taken;
+    // Host registers of the pair in bits 4-5 (BC DE HL), as 16-bit ones
+    int rp = jit_reg8[((op >> 3) & 6) | 1];
+    if (op >= 0x40 && op <= 0x7f) {
+      // MOV: mov r8, r8, or through [rsi+rbx]
+      int dst = (op >> 3) & 7, src = op & 7;
+      if (src == 6) {
+        jit_check_mem(&e, 3, PAGE_READ_SLOW, pc, before);
+        jit_bytes(&e, 3, 0x8a, 0x04 | jit_reg8[dst] << 3, 0x1e);
+      } else if (dst == 6) {
+        jit_check_mem(&e, 3, 0xff, pc, before);
+        jit_bytes(&e, 3, 0x88, 0x04 | jit_reg8[src] << 3, 0x1e);
+      } else {
+        jit_bytes(&e, 2, 0x88, 0xc0 | jit_reg8[src] << 3 | jit_reg8[dst]);
+      }
+    } else if (op >= 0x80 && op <= 0xbf) {
+      int src = op & 7;
+      if (src == 6)
+        jit_check_mem(&e, 3, PAGE_READ_SLOW, pc, before);
+      jit_alu(&e, (op >> 3) & 7, src == 6 ? JIT_SRC_MEM : JIT_SRC_REG,
+              jit_reg8[src], flags);
+    } else if ((op & 0xc7) == 0xc6) {
+      // ADI ACI SUI SBI ANI XRI ORI CPI
+      jit_alu(&e, (op >> 3) & 7, JIT_SRC_IMM, d->imm & 0xff, flags);
+    } else if ((op & 0xc6) == 0x04) {
+      // INR/DCR: inc/dec reg or byte [rsi+rbx]
+      int r = (op >> 3) & 7, dcr = op & 1;
+      if (r == 6) {
+        jit_check_mem(&e, 3, 0xff, pc, before);
+        jit_bytes(&e, 3, 0xfe, dcr ? 0x0c : 0x04, 0x1e);
+      } else {
+        jit_bytes(&e, 2, 0xfe, (dcr ? 0xc8 : 0xc0) | jit_reg8[r]);
+      }
+      if (flags)
+        jit_flags_inr(&e, dcr);
+    } else if ((op & 0xc7) == 0x06) {
+      // MVI: mov r8, imm8 or mov byte [rsi+rbx], imm8
+      int r = (op >> 3) & 7;
+      if (r == 6) {
+        jit_check_mem(&e, 3, 0xff, pc, before);
+        jit_bytes(&e, 4, 0xc6, 0x04, 0x1e, d->imm & 0xff);
+      } else {
+        jit_bytes(&e, 2, 0xb0 + jit_reg8[r], d->imm & 0xff);
+      }
+    } else if ((op & 0xc7) == 0x00) {
+      // NOP and its undocumented twins
+    } else if ((op & 0xcf) == 0x01) {
+      // LXI: mov cx/dx/bx/r9w, imm16
+      if (op == 0x31)
+        jit_bytes(&e, 3, 0x66, 0x41, 0xb9);
+      else
+        jit_bytes(&e, 2, 0x66, 0xb8 + rp);
+      jit_u16(&e, d->imm);
+    } else if ((op & 0xc7) == 0x03) {
+      // INX/DCX: inc/dec cx/dx/bx/r9w
+      uint8_t dec = op & 0x08;
+      if ((op & 0x30) == 0x30)
+        jit_bytes(&e, 4, 0x66, 0x41, 0xff, 0xc1 | dec);
+      else
+        jit_bytes(&e, 3, 0x66, 0xff, 0xc0 | dec | rp);
+    } else if ((op & 0xcf) == 0x09) {
+      // DAD: add bx, cx/dx/bx/r9w; CY from CF
+      if (op == 0x39)
+        jit_bytes(&e, 4, 0x66, 0x44, 0x01, 0xcb);
+      else
+        jit_bytes(&e, 3, 0x66, 0x01, 0xc3 | rp << 3);
+      if (flags)
+        jit_carry(&e);
+    } else if ((op & 0xcf) == 0xc5) {
+      // PUSH: mov word [rsi+r9], cx/dx/bx, or A and the flags built in
+      // r8w: movzx r8d, al; shl r8d, 8; mov r10d, ebp; or r10d, 2;
+      // or r8d, r10d
+      jit_check_stack(&e, -2, 0xff, pc, before);
+      jit_bytes(&e, 5, 0x66, 0x41, 0x83, 0xe9, 0x02); // sub r9w, 2
+      if (op == 0xf5) {
+        jit_bytes(&e, 4, 0x44, 0x0f, 0xb6, 0xc0);
+        jit_bytes(&e, 4, 0x41, 0xc1, 0xe0, 0x08);
+        jit_bytes(&e, 3, 0x41, 0x89, 0xea);
+        jit_bytes(&e, 4, 0x41, 0x83, 0xca, 0x02);
+        jit_bytes(&e, 3, 0x45, 0x09, 0xd0);
+        jit_bytes(&e, 5, 0x66, 0x46, 0x89, 0x04, 0x0e);
+      } else {
+        jit_bytes(&e, 5, 0x66, 0x42, 0x89, 0x04 | rp << 3, 0x0e);
+      }
+    } else if ((op & 0xcf) == 0xc1) {
+      // POP: mov cx/dx/bx, word [rsi+r9], or A and the flags from r8w:
+      // movzx r8d, word [rsi+r9]; mov eax, r8d; shr eax, 8;
+      // movzx ebp, r8b; and ebp, mask
+      jit_check_stack(&e, 0, PAGE_READ_SLOW, pc, before);
+      if (op == 0xf1) {
+        jit_bytes(&e, 5, 0x46, 0x0f, 0xb7, 0x04, 0x0e);
+        jit_bytes(&e, 3, 0x44, 0x89, 0xc0);
+        jit_bytes(&e, 3, 0xc1, 0xe8, 0x08);
+        jit_bytes(&e, 4, 0x41, 0x0f, 0xb6, 0xe8);
+        jit_bytes(&e, 3, 0x83, 0xe5, FLAGS_PSW);
+      } else {
+        jit_bytes(&e, 5, 0x66, 0x42, 0x8b, 0x04 | rp << 3, 0x0e);
+      }
+      jit_bytes(&e, 5, 0x66, 0x41, 0x83, 0xc1, 0x02); // add r9w, 2
+    } else if ((op & 0xc7) == 0xc2) {
+      // Jcc
+      jit_cond(&e, op, &not_taken);
+      jit_exit(&e, d->imm, cycles);
+      jit_patch(not_taken, e.p);
+      jit_exit(&e, next, cycles);
+    } else if ((op & 0xc7) == 0xc4) {
+      // Ccc
+      jit_cond(&e, op, &not_taken);
+      jit_push(&e, next, pc, before);
+      jit_exit(&e, d->imm, cycles + CYCLES_COND_TAKEN);
+      jit_patch(not_taken, e.p);
+      jit_exit(&e, next, cycles);
+    } else if ((op & 0xc7) == 0xc0) {
+      // Rcc
+      jit_cond(&e, op, &not_taken);
+      jit_pop_pc(&e, pc, before);
+      jit_ret_exit(&e, cycles + CYCLES_COND_TAKEN);
+      jit_patch(not_taken, e.p);
+      jit_exit(&e, next, cycles);
+    } else if ((op & 0xc7) == 0xc7) {
+      // RST
+      jit_push(&e, next, pc, before);
+      jit_exit(&e, op & 0x38, cycles);
+    } else {
+      switch (op) {
+      case 0x02: // STAX B/D: mov [rsi+rcx/rdx], al
+      case 0x12:
+        jit_check_mem(&e, rp, 0xff, pc, before);
+        jit_bytes(&e, 3, 0x88, 0x04, 0x06 | rp << 3);
+        break;
+      case 0x0a: // LDAX B/D: mov al, [rsi+rcx/rdx]
+      case 0x1a:
+        jit_check_mem(&e, rp, PAGE_READ_SLOW, pc, before);
+        jit_bytes(&e, 3, 0x8a, 0x04, 0x06 | rp << 3);
+        break;
+      case 0x32: // STA: mov [rsi+addr], al
+        jit_check_addr(&e, d->imm, 0xff, pc, before);
+        jit_bytes(&e, 2, 0x88, 0x86);
+        jit_u32(&e, d->imm);
+        break;
+      case 0x3a: // LDA: mov al, [rsi+addr]
+        jit_check_addr(&e, d->imm, PAGE_READ_SLOW, pc, before);
+        jit_bytes(&e, 2, 0x8a, 0x86);
+        jit_u32(&e, d->imm);
+        break;
+      case 0x22: // SHLD: mov [rsi+addr], bx
+      case 0x2a: // LHLD: mov bx, [rsi+addr]
+      {
+        // The word at 0xffff wraps to address 0, left to the interpreter
+        if (d->imm == 0xffff)
+          return NULL;
+        uint8_t mask = op == 0x22 ? 0xff : PAGE_READ_SLOW;
+        jit_check_addr(&e, d->imm, mask, pc, before);
+        if ((d->imm & 0xff) == 0xff)
+          jit_check_addr(&e, d->imm + 1, mask, pc, before);
+        jit_bytes(&e, 3, 0x66, op == 0x22 ? 0x89 : 0x8b, 0x9e);
+        jit_u32(&e, d->imm);
+        break;
+      }
+      case 0x07: // RLC: rol al, 1
+      case 0x0f: // RRC: ror al, 1
+      case 0x17: // RAL: rcl al, 1
+      case 0x1f: // RAR: rcr al, 1
+        if (op >= 0x17)
+          jit_bytes(&e, 4, 0x0f, 0xba, 0xe5, 0x00); // bt ebp, 0
+        jit_bytes(&e, 2, 0xd0, op == 0x07   ? 0xc0
+                               : op == 0x0f ? 0xc8
+                               : op == 0x17 ? 0xd0
+                                            : 0xd8);
+        if (flags)
+          jit_carry(&e);
+        break;
+      case 0x2f: // CMA: not al
+        jit_bytes(&e, 2, 0xf6, 0xd0);
+        break;
+      case 0x37: // STC: or ebp, CY
+        if (flags)
+          jit_bytes(&e, 3, 0x83, 0xcd, FLAG_CY);
+        break;
+      case 0x3f: // CMC: xor ebp, CY
+        if (flags)
+          jit_bytes(&e, 3, 0x83, 0xf5, FLAG_CY);
+        break;
+      case 0xeb: // XCHG: xchg dx, bx
+        jit_bytes(&e, 3, 0x66, 0x87, 0xd3);
+        break;
+      case 0xf9: // SPHL: mov r9w, bx
+        jit_bytes(&e, 4, 0x66, 0x41, 0x89, 0xd9);
+        break;
+      case 0xe9: // PCHL: movzx r8d, bx
+        jit_bytes(&e, 4, 0x44, 0x0f, 0xb7, 0xc3);
+        jit_ret_exit(&e, cycles);
+        break;
+      case 0xc3: // JMP
+      case 0xcb:
+        jit_exit(&e, d->imm, cycles);
+        break;
+      case 0xcd: // CALL
+      case 0xdd:
+      case 0xed:
+      case 0xfd:
+        jit_push(&e, next, pc, before);
+        jit_exit(&e, d->imm, cycles);
+        break;
+      case 0xc9: // RET
+      case 0xd9:
+        jit_pop_pc(&e, pc, before);
+        jit_ret_exit(&e, cycles);
+        break;
+      default:
+        return NULL;
+      }
+    }
+    pc = next;
+  }
+  if (!block_end8080[b->insts[b->count - 1].opcode])
+    jit_exit(&e, pc, cycles);
+
+  for (int i = 0; i < e.nstubs; i++) {
+    JitStub *s = &e.stubs[i];
+    jit_patch(s->patch, e.p);
+    jit_exit(&e, s->pc, s->cycles);
+  }
+  jit->used = e.p - jit->code;
+  return entry;
+}
+
+int jit_enable(State8080 *state) {
+  // Gives `state` a code buffer, after which run_cycles() compiles hot
+  // blocks. Returns 0 if there is no memory for it or the host refuses
+  // executable memory.
+  Jit8080 *jit = calloc(1, sizeof(Jit8080));
+  if (jit == NULL)
+    return 0;
+  jit->code = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jit->code == MAP_FAILED) {
+    free(jit);
+    return 0;
+  }
+  jit->threshold = JIT_THRESHOLD;
+  state->jit = jit;
+  return 1;
+}
+
+static int jit_block(State8080 *state, Block8080 *b) {
+  // Runs `b` natively if it is compiled, or hot enough to be compiled now.
+  // Returns the cycles used, 0 if the interpreter has to run it.
+  state->jit->entries++;
+  if (b->native == NULL) {
+    if (b->hits == 0xff || ++b->hits < state->jit->threshold)
+      return 0;
+    b->native = jit_compile(state, b);
+    if (b->native == NULL) {
+      b->hits = 0xff; // not translatable, the interpreter keeps it
+      return 0;
+    }
+    state->jit->compiled++;
+  }
+  state->jit->native++;
+  sync_flags(state);
+  return ((int (*)(State8080 *))b->native)(state);
+}
+
+static void jit_report(const State8080 *state) {
+  // How much of the run the compiled code covered
+  const Jit8080 *jit = state->jit;
+  if (jit == NULL || jit->entries == 0)
+    return;
+  printf("jit: %d blocks compiled, %.1f%% of %llu block entries ran "
+         "natively, %d dead flag updates left out\n",
+         jit->compiled, 100.0 * jit->native / jit->entries,
+         (unsigned long long)jit->entries, jit->dead_flags);
+}
+#endif
+
+#ifdef STATIC_ROM
+// Blocks of a fixed ROM translated to C by recompiler.c
+#include STATIC_ROM
+
+static int static_rom_enable(State8080 *state) {
+  // Lets the translated blocks run if memory holds the ROM they came from.
+  // Its pages count as code, so a store into them turns them off again.
+  state->static_rom = 0;
+  if (static_rom_matches(state->memory)) {
+    state->static_rom = STATIC_ROM_SIZE;
+    for (int p = 0; p < (STATIC_ROM_SIZE + 0xff) >> 8; p++)
+      state->pages[p] |= PAGE_CODE;
+  }
+  return state->static_rom != 0;
+}
+#endif
+
+// Instruction dispatch. By default the opcode bodies below are cases of a
+// switch, building with -DTHREADED_DISPATCH (GCC/Clang only) turns every
+// opcode into a label that jumps to the next handler itself through the
+// address stored in its predecoded instruction, giving the host one indirect
+// branch per handler.
+//
+// Instructions run in spans: a cached basic block, or just its first
+// instruction when stepping. The cycle budget is checked between
+// spans, so a run may overshoot it by up to one block.
+
+// Each handler steps pc and the cycle count by constants for its opcode, so
+// the next fetch never waits on a load. Operands are already in d->imm.
+#define ADVANCE(n)                                                             \
+  pc += length8080[n];                                                         \
+  cycles += cycles8080[n];
+#define IMM8 ((uint8_t)d->imm)
+#define IMM16 (d->imm)
+
+// Stores that overwrite cached code end the span after this instruction,
+// the rest of the block may be stale
+#define WRITE_MEM(addr, value)                                                 \
+  do {                                                                         \
+    if (write_mem(state, addr, value))                                         \
+      end = d + 1;                                                             \
+  } while (0)
+
+#ifdef SUPERINSTRUCTIONS
+#define COUNT_RUN() (block->runs += !step)
+#else
+#define COUNT_RUN()
+#endif
+
+#define ENTER_SPAN()                                                           \
+  do {                                                                         \
+    block = next_block(state, step ? NULL : block, pc, HANDLERS);              \
+    COUNT_RUN();                                                               \
+    d = block->insts;                                                          \
+    end = d + (step ? 1 : block->count);                                       \
+  } while (0)
+
+// Runs the span as C generated ahead of time when the ROM has a block at pc.
+// Wait loops idle_loop() picked out are left to the interpreter so that
+// IDLE_SPAN can skip them to the next event. The chaining hint is dropped,
+// the interpreted block before it did not lead straight to the next one.
+#ifdef STATIC_ROM
+#define STATIC_SPAN(again)                                                     \
+  if (!step && state->static_rom) {                                            \
+    block = next_block(state, NULL, pc, HANDLERS);                             \
+    state->pc = pc;                                                            \
+    int ran = block->idle ? 0 : static_rom_block(state);                       \
+    block = NULL;                                                              \
+    if (ran) {                                                                 \
+      cycles += ran;                                                           \
+      pc = state->pc;                                                          \
+      idle = NULL;                                                             \
+      again;                                                                   \
+    }                                                                          \
+  }
+#else
+#define STATIC_SPAN(again)
+#endif
+
+// Skips time in a wait loop. A block idle_loop() picked out that comes
+// round to the registers it had the last time round does the same thing
+// until an interrupt, so the rest of the budget goes by in whole trips
+// round the loop. Blocks that keep changing registers, like a delay loop
+// counting down, stop being checked after IDLE_TRIES trips. A trip that
+// loaded from a device is never skipped either, the device can answer
+// differently next time round. Loads are counted as the loop runs, the
+// address LDAX or MOV r,M reads is not known when the block is built.
+#define IDLE_REGS offsetof(State8080, pc) // registers, flags and SP
+#define IDLE_SPAN()                                                            \
+  if (block->idle && !step) {                                                  \
+    sync_flags(state);                                                         \
+    if (block == idle) {                                                       \
+      if (memcmp(state, idle_regs, IDLE_REGS) == 0 &&                          \
+          state->mmio_reads == idle_mmio) {                                    \
+        int trip = cycles - idle_cycles;                                       \
+        int skip = (budget - cycles) / trip * trip;                            \
+        cycles += skip;                                                        \
+        state->idle_skipped += skip;                                           \
+        block->idle = IDLE_TRIES;                                              \
+      } else {                                                                 \
+        block->idle--;                                                         \
+      }                                                                        \
+    }                                                                          \
+    idle = block;                                                              \
+    memcpy(idle_regs, state, IDLE_REGS);                                       \
+    idle_cycles = cycles;                                                      \
+    idle_mmio = state->mmio_reads;                                             \
+  } else {                                                                     \
+    idle = NULL;                                                               \
+  }
+
+// Hands the span to compiled code when the JIT has (or now makes) some for
+// the block, `again` starts the next span
+#ifdef JIT
+#define NATIVE_SPAN(again)                                                     \
+  if (!step && state->jit != NULL) {                                           \
+    int native = jit_block(state, block);                                      \
+    if (native) {                                                              \
+      cycles += native;                                                        \
+      pc = state->pc;                                                          \
+      again;                                                                   \
+    }                                                                          \
+  }
+#else
+#define NATIVE_SPAN(again)
+#endif
+
+#ifdef THREADED_DISPATCH
+#if !defined(__GNUC__)
+#error "THREADED_DISPATCH needs the labels-as-values extension (GCC/Clang)"
+#endif
+#define OP(n) op_##n: ADVANCE(n)
+#define FUSED(n) op_##n:
+#define NEXT                                                                   \
+  do {                                                                         \
+    if (++d < end)                                                             \
+      goto *d->handler;                                                        \
+    goto next_span;                                                            \
+  } while (0)
+#define HANDLERS dispatch
+#define OPL(h, l) &&op_0x##h##l
+#define OPROW(h)                                                               \
+  OPL(h, 0), OPL(h, 1), OPL(h, 2), OPL(h, 3), OPL(h, 4), OPL(h, 5), OPL(h, 6), \
+      OPL(h, 7), OPL(h, 8), OPL(h, 9), OPL(h, a), OPL(h, b), OPL(h, c),        \
+      OPL(h, d), OPL(h, e), OPL(h, f)
+#else
+#define OP(n)                                                                  \
+  case n:                                                                      \
+    ADVANCE(n)
+#define FUSED(n) case n:
+#define NEXT break
+#define HANDLERS NULL
+#endif
+
+// Opcode families. The 8080 encodes registers in 3-bit fields (B C D E H L
+// M A) and register pairs in 2-bit ones, so each family below expands to
+// one handler per register or pair. M is the byte at HL, stores to it go
+// through WRITE_MEM. `imm` stands for the immediate operand.
+#define REG_b state->b
+#define REG_c state->c
+#define REG_d state->d
+#define REG_e state->e
+#define REG_h state->h
+#define REG_l state->l
+#define REG_M read_mem(state, state->hl)
+#define REG_a state->a
+#define REG_imm IMM8
+
+// Handlers for a row of eight opcodes whose low three bits pick the source
+#define SRC_ROW_LO(hi, family, x)                                              \
+  family(0x##hi##0, x, b) family(0x##hi##1, x, c) family(0x##hi##2, x, d)      \
+  family(0x##hi##3, x, e) family(0x##hi##4, x, h) family(0x##hi##5, x, l)      \
+  family(0x##hi##6, x, M) family(0x##hi##7, x, a)
+#define SRC_ROW_HI(hi, family, x)                                              \
+  family(0x##hi##8, x, b) family(0x##hi##9, x, c) family(0x##hi##a, x, d)      \
+  family(0x##hi##b, x, e) family(0x##hi##c, x, h) family(0x##hi##d, x, l)      \
+  family(0x##hi##e, x, M) family(0x##hi##f, x, a)
+
+#define NOP(n) OP(n) NEXT;
+#define MOV(n, dst, src) OP(n) REG_##dst = REG_##src; NEXT;
+#define MOV_TO_M(n, src) OP(n) WRITE_MEM(state->hl, REG_##src); NEXT;
+#define MVI(n, r) OP(n) REG_##r = IMM8; NEXT;
+#define INR(n, r) OP(n) REG_##r = alu_inr(state, REG_##r); NEXT;
+#define DCR(n, r) OP(n) REG_##r = alu_dcr(state, REG_##r); NEXT;
+
+#define ALU(n, op, src) OP(n) op(REG_##src); NEXT;
+#define ALU_ADD(v) state->a = alu_add(state, state->a, v, 0)
+#define ALU_ADC(v) state->a = alu_add(state, state->a, v, state->f & FLAG_CY)
+#define ALU_SUB(v) state->a = alu_sub(state, state->a, v, 0)
+#define ALU_SBB(v) state->a = alu_sub(state, state->a, v, state->f & FLAG_CY)
+#define ALU_ANA(v) state->a = alu_ana(state, state->a, v)
+#define ALU_XRA(v) state->a = alu_logic(state, state->a ^ v)
+#define ALU_ORA(v) state->a = alu_logic(state, state->a | v)
+#define ALU_CMP(v) alu_sub(state, state->a, v, 0)
+
+#define PUSH16(value)                                                          \
+  do {                                                                         \
+    uint16_t pushed = (value);                                                 \
+    WRITE_MEM((uint16_t)(state->sp - 1), pushed >> 8);                         \
+    WRITE_MEM((uint16_t)(state->sp - 2), pushed & 0xff);                       \
+    state->sp -= 2;                                                            \
+  } while (0)
+
+#define LXI(n, rp) OP(n) state->rp = IMM16; NEXT;
+#define STAX(n, rp) OP(n) WRITE_MEM(state->rp, state->a); NEXT;
+#define LDAX(n, rp) OP(n) state->a = read_mem(state, state->rp); NEXT;
+#define INX(n, rp) OP(n) state->rp++; NEXT;
+#define DCX(n, rp) OP(n) state->rp--; NEXT;
+#define DAD(n, rp)                                                             \
+  OP(n) {                                                                      \
+    uint32_t res = state->hl + state->rp;                                      \
+    state->hl = res;                                                           \
+    set_carry(state, res >> 16);                                               \
+  }                                                                            \
+  NEXT;
+#define PUSH(n, rp) OP(n) PUSH16(state->rp); NEXT;
+#define POP(n, rp) OP(n) state->rp = pop16(state); NEXT;
+
+// Branch conditions by their mnemonic suffix. CY is always current, the
+// others need sync_flags() first.
+#define COND_NZ !(state->f & FLAG_Z)
+#define COND_Z (state->f & FLAG_Z)
+#define COND_NC !(state->f & FLAG_CY)
+#define COND_C (state->f & FLAG_CY)
+#define COND_PO !(state->f & FLAG_P)
+#define COND_PE (state->f & FLAG_P)
+#define COND_P !(state->f & FLAG_S)
+#define COND_M (state->f & FLAG_S)
+#define SYNC_NZ 1
+#define SYNC_Z 1
+#define SYNC_NC 0
+#define SYNC_C 0
+#define SYNC_PO 1
+#define SYNC_PE 1
+#define SYNC_P 1
+#define SYNC_M 1
+
+#define JMP(n) OP(n) pc = IMM16; NEXT;
+#define CALL(n) OP(n) PUSH16(pc); pc = IMM16; NEXT;
+#define RET(n) OP(n) pc = pop16(state); NEXT;
+#define RST(n, vector) OP(n) PUSH16(pc); pc = vector; NEXT;
+#define JCC(n, cc)                                                             \
+  OP(n) if (SYNC_##cc) sync_flags(state);                                      \
+  if (COND_##cc)                                                               \
+    pc = IMM16;                                                                \
+  NEXT;
+#define CCC(n, cc)                                                             \
+  OP(n) if (SYNC_##cc) sync_flags(state);                                      \
+  if (COND_##cc) {                                                             \
+    cycles += CYCLES_COND_TAKEN;                                               \
+    PUSH16(pc);                                                                \
+    pc = IMM16;                                                                \
+  }                                                                            \
+  NEXT;
+#define RCC(n, cc)                                                             \
+  OP(n) if (SYNC_##cc) sync_flags(state);                                      \
+  if (COND_##cc) {                                                             \
+    cycles += CYCLES_COND_TAKEN;                                               \
+    pc = pop16(state);                                                         \
+  }                                                                            \
+  NEXT;
+
+static int execute8080(State8080 *state, int budget, int step) {
+  // Executes instructions until at least `budget` cycles have been used,
+  // one at a time if `step` is set, otherwise a block at a time
+  int cycles = 0;
+  Decoded8080 *d, *end;
+  Block8080 *block = NULL;
+  Block8080 *idle = NULL; // wait loop candidate that ran last, see IDLE_SPAN
+  uint8_t idle_regs[IDLE_REGS];
+  int idle_cycles = 0;
+  uint32_t idle_mmio = 0;
+  if (state->blocks == NULL)
+    state->blocks = calloc(1, sizeof(BlockCache8080));
+  uint16_t pc = state->pc; // kept local so the fetch does not wait on memory
+#ifdef THREADED_DISPATCH
+  static const void *const dispatch[] = {
+      OPROW(0), OPROW(1), OPROW(2), OPROW(3), OPROW(4), OPROW(5),
+      OPROW(6), OPROW(7), OPROW(8), OPROW(9), OPROW(a), OPROW(b),
+      OPROW(c), OPROW(d), OPROW(e), OPROW(f),
+#ifdef SUPERINSTRUCTIONS
+      // Slot 6 (M) of the DCR, CMP and MOV M families is not fused
+      OPL(10, 0), OPL(10, 1), OPL(10, 2), OPL(10, 3), OPL(10, 4), OPL(10, 5),
+      OPL(0, 0), OPL(10, 7), OPL(10, 8), OPL(10, 9), OPL(10, a), OPL(10, b),
+      OPL(10, c), OPL(10, d), OPL(0, 0), OPL(10, f), OPL(11, 0), OPL(11, 1),
+      OPL(11, 2), OPL(11, 3), OPL(11, 4), OPL(11, 5), OPL(11, 6), OPL(11, 7),
+      OPL(11, 8), OPL(11, 9), OPL(11, a), OPL(0, 0), OPL(11, c), OPL(11, d)
+#endif
+  };
+next_span:
+  if (cycles >= budget)
+    goto done;
+  STATIC_SPAN(goto next_span);
+  ENTER_SPAN();
+  IDLE_SPAN();
+  NATIVE_SPAN(goto next_span);
+  goto *d->handler;
+#else
+  while (cycles < budget) {
+    STATIC_SPAN(continue);
+    ENTER_SPAN();
+    IDLE_SPAN();
+    NATIVE_SPAN(continue);
+    for (; d < end; d++) {
+      switch (DISPATCH_KEY(d)) {
+#endif
+    // Every opcode, generated from its register and condition fields by
+    // the families defined above execute8080()
+    NOP(0x00)
+    LXI(0x01, bc)
+    STAX(0x02, bc)
+    INX(0x03, bc)
+    INR(0x04, b)
+    DCR(0x05, b)
+    MVI(0x06, b)
+    OP(0x07) // RLC
+    {
+      set_carry(state, state->a >> 7);
+      state->a = (state->a << 1) | (state->a >> 7);
+    } NEXT;
+    NOP(0x08)
+    DAD(0x09, bc)
+    LDAX(0x0a, bc)
+    DCX(0x0b, bc)
+    INR(0x0c, c)
+    DCR(0x0d, c)
+    MVI(0x0e, c)
+    OP(0x0f) // RRC
+    {
+      set_carry(state, state->a & 1);
+      state->a = (state->a >> 1) | (state->a << 7);
+    } NEXT;
+
+    NOP(0x10)
+    LXI(0x11, de)
+    STAX(0x12, de)
+    INX(0x13, de)
+    INR(0x14, d)
+    DCR(0x15, d)
+    MVI(0x16, d)
+    OP(0x17) // RAL
+    {
+      uint8_t carry = state->f & FLAG_CY;
+      set_carry(state, state->a >> 7);
+      state->a = (state->a << 1) | carry;
+    } NEXT;
+    NOP(0x18)
+    DAD(0x19, de)
+    LDAX(0x1a, de)
+    DCX(0x1b, de)
+    INR(0x1c, e)
+    DCR(0x1d, e)
+    MVI(0x1e, e)
+    OP(0x1f) // RAR
+    {
+      uint8_t carry = state->f & FLAG_CY;
+      set_carry(state, state->a & 1);
+      state->a = (state->a >> 1) | (carry << 7);
+    } NEXT;
+
+    NOP(0x20)
+    LXI(0x21, hl)
+    OP(0x22) // SHLD adr
+      WRITE_MEM(IMM16, state->l);
+      WRITE_MEM((uint16_t)(IMM16 + 1), state->h);
+      NEXT;
+    INX(0x23, hl)
+    INR(0x24, h)
+    DCR(0x25, h)
+    MVI(0x26, h)
+    OP(0x27) // DAA
+      alu_daa(state);
+      NEXT;
+    NOP(0x28)
+    DAD(0x29, hl)
+    OP(0x2a) // LHLD adr
+      state->hl = read_mem16(state, IMM16);
+      NEXT;
+    DCX(0x2b, hl)
+    INR(0x2c, l)
+    DCR(0x2d, l)
+    MVI(0x2e, l)
+    OP(0x2f) // CMA
+      state->a = ~state->a;
+      NEXT;
+
+    NOP(0x30)
+    LXI(0x31, sp)
+    OP(0x32) // STA adr
+      WRITE_MEM(IMM16, state->a);
+      NEXT;
+    INX(0x33, sp)
+    OP(0x34) // INR M
+    {
+      uint16_t offset = state->hl;
+      WRITE_MEM(offset, alu_inr(state, read_mem(state, offset)));
+    } NEXT;
+    OP(0x35) // DCR M
+    {
+      uint16_t offset = state->hl;
+      WRITE_MEM(offset, alu_dcr(state, read_mem(state, offset)));
+    } NEXT;
+    OP(0x36) // MVI M, byte
+      WRITE_MEM(state->hl, IMM8);
+      NEXT;
+    OP(0x37) // STC
+      state->f |= FLAG_CY;
+      NEXT;
+    NOP(0x38)
+    DAD(0x39, sp)
+    OP(0x3a) // LDA adr
+      state->a = read_mem(state, IMM16);
+      NEXT;
+    DCX(0x3b, sp)
+    INR(0x3c, a)
+    DCR(0x3d, a)
+    MVI(0x3e, a)
+    OP(0x3f) // CMC
+      state->f ^= FLAG_CY;
+      NEXT;
+
+    // MOV dst, src: 01DDDSSS
+    SRC_ROW_LO(4, MOV, b)
+    SRC_ROW_HI(4, MOV, c)
+    SRC_ROW_LO(5, MOV, d)
+    SRC_ROW_HI(5, MOV, e)
+    SRC_ROW_LO(6, MOV, h)
+    SRC_ROW_HI(6, MOV, l)
+    MOV_TO_M(0x70, b)
+    MOV_TO_M(0x71, c)
+    MOV_TO_M(0x72, d)
+    MOV_TO_M(0x73, e)
+    MOV_TO_M(0x74, h)
+    MOV_TO_M(0x75, l)
+    OP(0x76) // HLT
+      // Stays on the HLT until an interrupt takes the CPU elsewhere. Nothing
+      // else can happen before then, so the rest of the budget goes by at
+      // once.
+      state->halted = 1;
+      pc--;
+      if (!step && cycles < budget) {
+        state->idle_skipped += budget - cycles;
+        cycles = budget;
+      }
+      NEXT;
+    MOV_TO_M(0x77, a)
+    SRC_ROW_HI(7, MOV, a)
+
+    // ALU op A, src: 10OOOSSS
+    SRC_ROW_LO(8, ALU, ALU_ADD)
+    SRC_ROW_HI(8, ALU, ALU_ADC)
+    SRC_ROW_LO(9, ALU, ALU_SUB)
+    SRC_ROW_HI(9, ALU, ALU_SBB)
+    SRC_ROW_LO(a, ALU, ALU_ANA)
+    SRC_ROW_HI(a, ALU, ALU_XRA)
+    SRC_ROW_LO(b, ALU, ALU_ORA)
+    SRC_ROW_HI(b, ALU, ALU_CMP)
+
+    RCC(0xc0, NZ)
+    POP(0xc1, bc)
+    JCC(0xc2, NZ)
+    JMP(0xc3)
+    CCC(0xc4, NZ)
+    PUSH(0xc5, bc)
+    ALU(0xc6, ALU_ADD, imm)
+    RST(0xc7, 0x00)
+    RCC(0xc8, Z)
+    RET(0xc9)
+    JCC(0xca, Z)
+    JMP(0xcb)
+    CCC(0xcc, Z)
+    CALL(0xcd)
+    ALU(0xce, ALU_ADC, imm)
+    RST(0xcf, 0x08)
+
+    RCC(0xd0, NC)
+    POP(0xd1, de)
+    JCC(0xd2, NC)
+    OP(0xd3) // OUT D8
+      port_out(state, IMM8, state->a);
+      NEXT;
+    CCC(0xd4, NC)
+    PUSH(0xd5, de)
+    ALU(0xd6, ALU_SUB, imm)
+    RST(0xd7, 0x10)
+    RCC(0xd8, C)
+    RET(0xd9)
+    JCC(0xda, C)
+    OP(0xdb) // IN D8
+      state->a = port_in(state, IMM8);
+      NEXT;
+    CCC(0xdc, C)
+    CALL(0xdd)
+    ALU(0xde, ALU_SBB, imm)
+    RST(0xdf, 0x18)
+
+    RCC(0xe0, PO)
+    POP(0xe1, hl)
+    JCC(0xe2, PO)
+    OP(0xe3) // XTHL
+    {
+      uint16_t hl = read_mem16(state, state->sp);
+      WRITE_MEM(state->sp, state->l);
+      WRITE_MEM((uint16_t)(state->sp + 1), state->h);
+      state->hl = hl;
+    } NEXT;
+    CCC(0xe4, PO)
+    PUSH(0xe5, hl)
+    ALU(0xe6, ALU_ANA, imm)
+    RST(0xe7, 0x20)
+    RCC(0xe8, PE)
+    OP(0xe9) // PCHL
+      pc = state->hl;
+      NEXT;
+    JCC(0xea, PE)
+    OP(0xeb) // XCHG
+    {
+      uint16_t de = state->de;
+      state->de = state->hl;
+      state->hl = de;
+    } NEXT;
+    CCC(0xec, PE)
+    CALL(0xed)
+    ALU(0xee, ALU_XRA, imm)
+    RST(0xef, 0x28)
+
+    RCC(0xf0, P)
+    OP(0xf1) // POP PSW
+    {
+      uint16_t psw = pop16(state);
+      state->a = psw >> 8;
+      set_psw_flags(state, psw & 0xff);
+    } NEXT;
+    JCC(0xf2, P)
+    OP(0xf3) // DI
+      state->int_enable = 0;
+      NEXT;
+    CCC(0xf4, P)
+    OP(0xf5) // PUSH PSW
+      PUSH16((state->a << 8) | psw_flags(state));
+      NEXT;
+    ALU(0xf6, ALU_ORA, imm)
+    RST(0xf7, 0x30)
+    RCC(0xf8, M)
+    OP(0xf9) // SPHL
+      state->sp = state->hl;
+      NEXT;
+    JCC(0xfa, M)
+    OP(0xfb) // EI
+      state->int_enable = 1;
+      NEXT;
+    CCC(0xfc, M)
+    CALL(0xfd)
+    ALU(0xfe, ALU_CMP, imm)
+    RST(0xff, 0x38)
+#ifdef SUPERINSTRUCTIONS
+    // Fused pairs and triples (see fuse_block). Each runs an instruction,
+    // and stops there if the span ends after it as when stepping, before
+    // moving d on to the next.
+#define FUSED_NEXT()                                                           \
+  if (d + 1 == end)                                                            \
+    NEXT;                                                                      \
+  d++;
+#define DCR_JNZ(n, reg)                                                        \
+  FUSED(n)                                                                     \
+  ADVANCE(0x05)                                                                \
+  state->reg = alu_dcr(state, state->reg);                                     \
+  FUSED_NEXT()                                                                 \
+  ADVANCE(0xc2)                                                                \
+  if (state->reg != 0)                                                         \
+    pc = IMM16;                                                                \
+  NEXT;
+#define CMP_JZ(n, reg)                                                         \
+  FUSED(n)                                                                     \
+  ADVANCE(0xb8)                                                                \
+  alu_sub(state, state->a, state->reg, 0);                                     \
+  FUSED_NEXT()                                                                 \
+  ADVANCE(0xc2)                                                                \
+  if ((state->a == state->reg) == ((d->opcode >> 3) & 1))                      \
+    pc = IMM16;                                                                \
+  NEXT;
+    DCR_JNZ(0x100, b)
+    DCR_JNZ(0x101, c)
+    DCR_JNZ(0x102, d)
+    DCR_JNZ(0x103, e)
+    DCR_JNZ(0x104, h)
+    DCR_JNZ(0x105, l)
+    DCR_JNZ(0x107, a)
+    CMP_JZ(0x108, b)
+    CMP_JZ(0x109, c)
+    CMP_JZ(0x10a, d)
+    CMP_JZ(0x10b, e)
+    CMP_JZ(0x10c, h)
+    CMP_JZ(0x10d, l)
+    CMP_JZ(0x10f, a)
+    FUSED(0x110) // CPI D8; JZ/JNZ adr
+    {
+      ADVANCE(0xfe)
+      uint8_t value = IMM8;
+      alu_sub(state, state->a, value, 0);
+      FUSED_NEXT()
+      ADVANCE(0xc2)
+      if ((state->a == value) == ((d->opcode >> 3) & 1))
+        pc = IMM16;
+    } NEXT;
+#define LDAX_INX(n, rp)                                                        \
+  FUSED(n)                                                                     \
+  ADVANCE(0x0a)                                                                \
+  state->a = read_mem(state, state->rp);                                       \
+  FUSED_NEXT()                                                                 \
+  ADVANCE(0x03)                                                                \
+  state->rp++;                                                                 \
+  NEXT;
+#define STAX_INX(n, rp)                                                        \
+  FUSED(n)                                                                     \
+  ADVANCE(0x02)                                                                \
+  WRITE_MEM(state->rp, state->a);                                              \
+  FUSED_NEXT()                                                                 \
+  ADVANCE(0x03)                                                                \
+  state->rp++;                                                                 \
+  NEXT;
+#define LXIH_MOVM(n, reg)                                                      \
+  FUSED(n)                                                                     \
+  ADVANCE(0x21)                                                                \
+  state->hl = IMM16;                                                           \
+  FUSED_NEXT()                                                                 \
+  ADVANCE(0x70)                                                                \
+  WRITE_MEM(state->hl, state->reg);                                            \
+  NEXT;
+    LDAX_INX(0x111, bc)
+    LDAX_INX(0x112, de)
+    STAX_INX(0x113, bc)
+    STAX_INX(0x114, de)
+    LXIH_MOVM(0x115, b)
+    LXIH_MOVM(0x116, c)
+    LXIH_MOVM(0x117, d)
+    LXIH_MOVM(0x118, e)
+    LXIH_MOVM(0x119, h)
+    LXIH_MOVM(0x11a, l)
+    LXIH_MOVM(0x11c, a)
+    FUSED(0x11d) // LDAX D; MOV M,A; INX H
+      ADVANCE(0x1a)
+      state->a = read_mem(state, state->de);
+      FUSED_NEXT()
+      ADVANCE(0x77)
+      WRITE_MEM(state->hl, state->a);
+      FUSED_NEXT()
+      ADVANCE(0x23)
+      state->hl++;
+      NEXT;
+#endif
+#ifdef THREADED_DISPATCH
+done:
+#else
+      }
+    }
+  }
+#endif
+  state->pc = pc;
+  return cycles;
+}
+
+int run_cycles(State8080 *state, int budget) {
+  // Executes instructions until at least `budget` cycles have been used
+  // Params:
+  //	State8080 *state - CPU state to run
+  //	int budget - Number of cycles to run for
+  //
+  // Returns:
+  //	int - Cycles actually consumed (may overshoot the budget by the
+  //	      last block)
+  return execute8080(state, budget, 0);
+}
+
+int Emulate8080p(State8080 *state) {
+  // Executes a single instruction, returns the cycles it took
+  return execute8080(state, 1, 1);
+}
+
+// Longest stretch run_until() hands run_cycles() at once, half the int
+// range so that the overshoot of the last block cannot overflow it
+#define RUN_SPAN_MAX (INT_MAX / 2)
+
+uint64_t run_until(State8080 *state, uint64_t until) {
+  // Runs to cycle `until` of the event clock, firing events as they come
+  // due. Between events the CPU runs freely in run_cycles(), in stretches
+  // of at most RUN_SPAN_MAX cycles. Returns the clock, which may be past
+  // `until` by the last block.
+  Events8080 *q = &state->events;
+  while (q->now < until) {
+    uint64_t deadline = until;
+    if (q->count > 0 && q->heap[0].when < deadline)
+      deadline = q->heap[0].when;
+    if (deadline - q->now > RUN_SPAN_MAX)
+      deadline = q->now + RUN_SPAN_MAX;
+    if (q->now < deadline)
+      q->now += run_cycles(state, (int)(deadline - q->now));
+    while (q->count > 0 && q->heap[0].when <= q->now) {
+      Event8080 e = next_event(state);
+      e.fire(state, e.device, e.when);
+    }
+  }
+  return q->now;
+}
+
+// Benchmark loop: ALU and INR/DCR work closed by a JNZ that runs 256 times
+// before falling through to a JMP back to the top.
+static const unsigned char bench_program[] = {
+    0x06, 0x00,       // MVI B, 0
+    0x0c,             // INR C
+    0x81,             // ADD C
+    0x88,             // ADC B
+    0x92,             // SUB D
+    0x14,             // INR D
+    0x1d,             // DCR E
+    0x23,             // INX H
+    0x05,             // DCR B
+    0xc2, 0x02, 0x00, // JNZ 0002
+    0xc3, 0x02, 0x00, // JMP 0002
+};
+#define BENCH_ROUND_INSTS (256 * 9 + 1)
+#define BENCH_ROUND_CYCLES (256 * 47 + 10)
+#define BENCH_CYCLES 1000000000LL
+
+static double seconds_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void benchmark(void) {
+  // Times the interpreter on bench_program, once in half-frame slices
+  // through run_cycles() and once one instruction per Emulate8080p() call
+  State8080 state = {0};
+  uint8_t *memory = alloc_memory();
+  memcpy(memory, bench_program, sizeof(bench_program));
+  attach_memory(&state, memory);
+#if defined(THREADED_DISPATCH) && defined(SUPERINSTRUCTIONS)
+  const char *engine = "threaded+fused";
+#elif defined(THREADED_DISPATCH)
+  const char *engine = "threaded";
+#elif defined(SUPERINSTRUCTIONS)
+  const char *engine = "switch+fused";
+#else
+  const char *engine = "switch";
+#endif
+#ifdef JIT
+  // Compiled blocks only run under run_cycles(), stepping stays interpreted
+  if (jit_enable(&state))
+    engine = "jit";
+#endif
+#ifdef STATIC_ROM
+  // Only if the recompiler was run on bench_program itself
+  if (static_rom_enable(&state))
+    engine = "static";
+#endif
+
+  for (int per_call = 0; per_call < 2; per_call++) {
+    state.pc = 0;
+    long long done = 0;
+    double start = seconds_now();
+    if (per_call) {
+      while (done < BENCH_CYCLES)
+        done += Emulate8080p(&state);
+    } else {
+      while (done < BENCH_CYCLES)
+        done += run_cycles(&state, CYCLES_PER_HALF_FRAME);
+    }
+    double elapsed = seconds_now() - start;
+    double insts = (double)done * BENCH_ROUND_INSTS / BENCH_ROUND_CYCLES;
+    printf("%-14s %-12s %8.1f M instructions/s  %6.1fx real time\n", engine,
+           per_call ? "Emulate8080p" : "run_cycles", insts / elapsed / 1e6,
+           done / elapsed / CPU_CLOCK_HZ);
+  }
+#ifdef SUPERINSTRUCTIONS
+  fusion_report(&state);
+#endif
+#ifdef JIT
+  jit_report(&state);
+#endif
+
+  // Rendering whatever the benchmark left in VRAM through the overlay,
+  // whole frames and then frames where a store changed one line
+  static ScreenRows rows;
+  static uint32_t overlay[SCREEN_WIDTH * SCREEN_HEIGHT];
+  static uint32_t frame[SCREEN_WIDTH * SCREEN_HEIGHT];
+  video_overlay_invaders(overlay, NULL);
+  map_video(&state, VRAM_START, VRAM_SIZE);
+  for (int dirty_only = 0; dirty_only < 2; dirty_only++) {
+    int frames = 0;
+    double start = seconds_now(), elapsed;
+    do {
+      for (int i = 0; i < 100; i++, frames++) {
+        uint32_t groups = VIDEO_ALL_GROUPS;
+        if (dirty_only) {
+          VideoDirty dirty;
+          uint16_t addr = VRAM_START + frames * 97 % VRAM_SIZE;
+          write_mem(&state, addr, read_mem(&state, addr) + 1);
+          groups = take_video_dirty(&state, &dirty);
+        }
+        video_rows(state.memory + VRAM_START, rows, groups);
+        video_rgba((const uint8_t(*)[SCREEN_ROW_BYTES])rows, overlay, groups,
+                   frame);
+      }
+      elapsed = seconds_now() - start;
+    } while (elapsed < 0.2);
+    printf("%-14s %-12s %8.2f us/frame\n", VIDEO_KERNEL,
+           dirty_only ? "render 1 line" : "render", elapsed / frames * 1e6);
+  }
+
+  // Saving and restoring the machine as run-ahead does, here all 64K with
+  // code cached from the first page and one VRAM byte changed in between
+  static Snapshot8080 snap;
+  double save = 0, restore = 0;
+  int snapshots = 0;
+  do {
+    double start = seconds_now();
+    save_state(&state, &snap);
+    double mid = seconds_now();
+    write_mem(&state, VRAM_START + snapshots % VRAM_SIZE, snapshots);
+    double end = seconds_now();
+    restore_state(&state, &snap);
+    restore += seconds_now() - end;
+    save += mid - start;
+    snapshots++;
+  } while (save + restore < 0.2);
+  printf("%-14s %-12s %8.2f us\n", "snapshot", "save", save / snapshots * 1e6);
+  printf("%-14s %-12s %8.2f us\n", "snapshot", "restore",
+         restore / snapshots * 1e6);
+  free(snap.memory);
+  free(state.memory);
+}
+
+#if defined(JIT) || defined(STATIC_ROM)
+// Cross-checks of the translated code: blocks run through the interpreter
+// and through their translation from the same state, and the registers,
+// flags, pc, cycles and memory must come out equal
+static uint32_t check_seed = 1;
+
+static uint32_t check_rand(void) {
+  check_seed = check_seed * 1103515245 + 12345;
+  return check_seed >> 8;
+}
+
+static int check_same(State8080 *x, State8080 *y) {
+  sync_flags(x);
+  sync_flags(y);
+  return x->a == y->a && x->f == y->f && x->bc == y->bc && x->de == y->de &&
+         x->hl == y->hl && x->sp == y->sp && x->pc == y->pc &&
+         x->int_enable == y->int_enable &&
+         memcmp(x->memory, y->memory, 0x10000) == 0;
+}
+
+static void check_dump(const char *name, State8080 *s) {
+  printf("  %-6s a=%02x f=%02x bc=%04x de=%04x hl=%04x sp=%04x pc=%04x\n",
+         name, s->a, s->f, s->bc, s->de, s->hl, s->sp, s->pc);
+}
+#endif
+
+#ifdef JIT
+// JIT cross-check: random programs built from the opcodes the translator
+// handles. HL points into the program now and then so that self-modifying
+// stores get exercised too.
+#define CHECK_PROGRAMS 2000
+#define CHECK_BLOCKS 200
+#define CHECK_CODE_SIZE 0x400
+#define CHECK_STACK 0xf000
+
+static uint8_t check_opcode(void) {
+  // Mostly straight-line work, with a branch every few instructions
+  static const uint8_t branches[] = {
+      0xc0, 0xc2, 0xc3, 0xc4, 0xc7, 0xc8, 0xc9, 0xca, 0xcc, 0xcd, 0xcf,
+      0xd0, 0xd2, 0xd4, 0xd7, 0xd8, 0xda, 0xdc, 0xdf, 0xe0, 0xe2, 0xe4,
+      0xe7, 0xe8, 0xe9, 0xea, 0xec, 0xef, 0xf0, 0xf2, 0xf4, 0xf7, 0xf8,
+      0xfa, 0xfc, 0xff};
+  if (check_rand() % 6 == 0)
+    return branches[check_rand() % sizeof(branches)];
+  for (;;) {
+    uint8_t op = check_rand();
+    if (jit_supported(op) && !block_end8080[op])
+      return op;
+  }
+}
+
+static void check_program(uint8_t *memory) {
+  // Fills the code area with whole instructions, every jump and call aiming
+  // at the start of one. The first 16 bytes are NOPs for RST 0 and 1, and
+  // the zeroed stack returns there too.
+  uint16_t starts[CHECK_CODE_SIZE];
+  int n = 0;
+  memset(memory, 0, 0x10000);
+  uint16_t pc = 16;
+  for (int i = 0; i < 16; i++)
+    starts[n++] = i;
+  while (pc < CHECK_CODE_SIZE - 3) {
+    uint8_t op = check_opcode();
+    memory[pc] = op;
+    memory[pc + 1] = check_rand();
+    memory[pc + 2] = check_rand();
+    starts[n++] = pc;
+    pc += length8080[op];
+  }
+  memory[pc] = 0xc3; // JMP 0000
+  memory[pc + 1] = memory[pc + 2] = 0;
+  for (pc = 16; pc < CHECK_CODE_SIZE; pc += length8080[memory[pc]]) {
+    uint8_t op = memory[pc];
+    if ((op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4 || op == 0xc3 ||
+        op == 0xcd) {
+      uint16_t target = starts[check_rand() % n];
+      memory[pc + 1] = target & 0xff;
+      memory[pc + 2] = target >> 8;
+    }
+  }
+}
+
+static void check_registers(State8080 *state) {
+  state->a = check_rand();
+  state->b = check_rand();
+  state->c = check_rand();
+  state->d = check_rand();
+  state->e = check_rand();
+  state->h = 0x40 + check_rand() % 0x80;
+  state->l = check_rand();
+  if (check_rand() % 8 == 0)
+    state->h = check_rand() % (CHECK_CODE_SIZE >> 8);
+  state->sp = CHECK_STACK;
+  state->pc = 16;
+  state->f = check_rand() & FLAGS_PSW;
+}
+
+static int check_runnable(uint8_t *memory, uint16_t pc) {
+  // Stores into the program may have turned the next block into something
+  // the interpreter cannot run either
+  for (int i = 0; i < BLOCK_MAX_INSTS; i++) {
+    uint8_t op = memory[pc];
+    if (!jit_supported(op))
+      return 0;
+    if (block_end8080[op])
+      break;
+    pc += length8080[op];
+  }
+  return 1;
+}
+
+int jit_crosscheck(void) {
+  // Returns 0 if every compared block matched
+  State8080 ref = {0}, jit = {0};
+  ref.memory = alloc_memory();
+  jit.memory = alloc_memory();
+  if (!jit_enable(&jit)) {
+    printf("jit: no executable memory\n");
+    return 1;
+  }
+  jit.jit->threshold = 1;
+  long blocks = 0;
+  for (int prog = 0; prog < CHECK_PROGRAMS; prog++) {
+    check_program(ref.memory);
+    check_registers(&ref);
+    // Fresh caches, the old blocks describe the last program
+    memset(ref.pages, 0, sizeof(ref.pages));
+    if (ref.blocks != NULL)
+      flush_blocks(&ref);
+    if (jit.blocks != NULL)
+      flush_blocks(&jit);
+    attach_memory(&ref, ref.memory);
+    uint8_t *memory = jit.memory;
+    BlockCache8080 *cache = jit.blocks;
+    Jit8080 *buffer = jit.jit;
+    memcpy(memory, ref.memory, MEMORY_SIZE + MEMORY_TAIL);
+    jit = ref;
+    jit.memory = memory;
+    jit.blocks = cache;
+    jit.jit = buffer;
+    for (int i = 0; i < CHECK_BLOCKS; i++) {
+      if (!check_runnable(ref.memory, ref.pc))
+        break;
+      State8080 before = ref;
+      int want = run_cycles(&ref, 1);
+      // Compiled code leaves early on any store into a code page, the rest
+      // of the block is then stepped through
+      int got = run_cycles(&jit, 1);
+      while (got < want)
+        got += Emulate8080p(&jit);
+      blocks++;
+      if (got != want || !check_same(&ref, &jit)) {
+        printf("jit: mismatch in program %d after the block at %04x, "
+               "%d cycles vs %d\n",
+               prog, before.pc, got, want);
+        check_dump("before", &before);
+        check_dump("interp", &ref);
+        check_dump("jit", &jit);
+        return 1;
+      }
+    }
+  }
+  printf("jit: %d programs, %ld blocks matched the interpreter, %d compiled\n",
+         CHECK_PROGRAMS, blocks, jit.jit->compiled);
+  return 0;
+}
+#endif
+
+#ifdef STATIC_ROM
+// Static ROM cross-check: every block of the built-in ROM runs from random
+// registers over random RAM. HL and SP point into the ROM now and then, so
+// stores that overwrite translated code get exercised too.
+#define STATIC_CHECK_RUNS 64
+
+static uint16_t static_check_addr(void) {
+  if (check_rand() % 4 == 0)
+    return check_rand() % STATIC_ROM_SIZE;
+  return check_rand();
+}
+
+int static_crosscheck(void) {
+  // Returns 0 if every block matched
+  State8080 ref = {0}, rom = {0};
+  ref.memory = alloc_memory();
+  rom.memory = alloc_memory();
+  for (int i = 0; i < MEMORY_SIZE; i++)
+    ref.memory[i] = check_rand();
+  long runs = 0;
+  int blocks = sizeof(static_rom_blocks) / sizeof(static_rom_blocks[0]);
+  for (int b = 0; b < blocks; b++) {
+    for (int run = 0; run < STATIC_CHECK_RUNS; run++) {
+      // The interpreter's cached blocks must not outlive a restored ROM
+      if (!static_rom_matches(ref.memory)) {
+        memcpy(ref.memory, static_rom_image, STATIC_ROM_SIZE);
+        if (ref.blocks != NULL)
+          flush_blocks(&ref);
+      }
+      attach_memory(&ref, ref.memory);
+      ref.a = check_rand();
+      ref.bc = check_rand();
+      ref.de = check_rand();
+      ref.hl = static_check_addr();
+      ref.sp = static_check_addr();
+      ref.f = check_rand() & FLAGS_PSW;
+      ref.int_enable = check_rand() & 1;
+      ref.pc = static_rom_blocks[b];
+      uint8_t *memory = rom.memory;
+      BlockCache8080 *cache = rom.blocks;
+      memcpy(memory, ref.memory, MEMORY_SIZE + MEMORY_TAIL);
+      rom = ref;
+      rom.memory = memory;
+      rom.blocks = cache;
+      State8080 before = ref;
+      static_rom_enable(&rom);
+      int got = static_rom_block(&rom);
+      // The interpreter steps the same instructions, a block ends early
+      // after a store into the ROM
+      int want = 0;
+      while (want < got)
+        want += Emulate8080p(&ref);
+      runs++;
+      if (got == 0 || got != want || !check_same(&ref, &rom)) {
+        printf("static: mismatch in the block at %04x, %d cycles vs %d\n",
+               before.pc, got, want);
+        check_dump("before", &before);
+        check_dump("interp", &ref);
+        check_dump("static", &rom);
+        return 1;
+      }
+    }
+  }
+  printf("static: %d blocks, %ld runs matched the interpreter\n", blocks, runs);
+  return 0;
+}
+
+// Wait loops: every translated block idle_loop() picks out runs from
+// random registers over zeroed RAM to a deadline STATIC_IDLE_CYCLES away.
+// One that still comes round to the same registers must have been skipped
+// to the deadline, not run trip by trip.
+#define STATIC_IDLE_CYCLES 1000000
+
+int static_idle_check(void) {
+  // Returns 0 if every loop that kept going was skipped through
+  State8080 state = {0};
+  state.memory = alloc_memory();
+  int blocks = sizeof(static_rom_blocks) / sizeof(static_rom_blocks[0]);
+  int loops = 0, spinning = 0;
+  static Block8080 loop; // decoded here, the static code bypasses the cache
+  for (int b = 0; b < blocks; b++) {
+    uint16_t start = static_rom_blocks[b];
+    memset(state.memory, 0, MEMORY_SIZE);
+    memcpy(state.memory, static_rom_image, STATIC_ROM_SIZE);
+    attach_memory(&state, state.memory);
+    loop.start = start;
+    loop.count = 0;
+    uint16_t pc = start;
+    do {
+      decode8080(&state, &loop.insts[loop.count], pc);
+      pc += loop.insts[loop.count++].len;
+    } while (loop.count < BLOCK_MAX_INSTS &&
+             !block_end8080[loop.insts[loop.count - 1].opcode]);
+    loop.end = pc;
+    if (!idle_loop(&loop))
+      continue;
+    if (state.blocks != NULL)
+      flush_blocks(&state);
+    static_rom_enable(&state);
+    state.a = check_rand();
+    state.bc = check_rand();
+    state.de = check_rand();
+    state.hl = check_rand();
+    state.sp = check_rand();
+    state.f = check_rand() & FLAGS_PSW;
+    state.pc = start;
+    state.idle_skipped = 0;
+    run_until(&state, state.events.now + STATIC_IDLE_CYCLES);
+    loops++;
+    // Still spinning if one more trip comes back to the same registers
+    uint8_t regs[IDLE_REGS];
+    sync_flags(&state);
+    memcpy(regs, &state, IDLE_REGS);
+    do
+      Emulate8080p(&state);
+    while (state.pc != start && state.pc >= loop.start && state.pc < loop.end);
+    sync_flags(&state);
+    if (state.pc != start || memcmp(regs, &state, IDLE_REGS) != 0)
+      continue;
+    spinning++;
+    if (state.idle_skipped < STATIC_IDLE_CYCLES / 2) {
+      printf("static: the wait loop at %04x ran trip by trip, %llu of %d "
+             "cycles skipped\n",
+             start, (unsigned long long)state.idle_skipped,
+             STATIC_IDLE_CYCLES);
+      return 1;
+    }
+  }
+  printf("static: %d wait loops, %d still spinning were skipped to the "
+         "deadline\n",
+         loops, spinning);
+  return 0;
+}
+#endif
+
+// The CPU runs on a thread of its own (emulate()), so that nothing the
+// host does to show frames or read input lands inside emulated time. It
+// publishes each finished frame through a triple buffer and takes input
+// from a queue, and neither side ever waits on the other.
+
+// A finished frame: its number and the video RAM it ended with
+typedef struct Frame8080 {
+  uint64_t number;
+  uint8_t vram[VRAM_SIZE];
+} Frame8080;
+
+// Three frames: the one being written, the one being read, and the newest
+// finished one in between, which each side swaps its own for. `middle` is
+// that one's index, with TRIPLE_FRESH set while the reader has not seen it.
+#define TRIPLE_FRESH 4
+typedef struct TripleBuffer {
+  Frame8080 frames[3];
+  _Atomic uint8_t middle;
+  uint8_t back;  // writer only
+  uint8_t front; // reader only
+} TripleBuffer;
+
+static void triple_init(TripleBuffer *tb) {
+  tb->back = 0;
+  atomic_init(&tb->middle, 1);
+  tb->front = 2;
+}
+
+static void triple_publish(TripleBuffer *tb) {
+  // Makes frames[back] the newest, the writer carries on in another
+  uint8_t old = atomic_exchange_explicit(&tb->middle, tb->back | TRIPLE_FRESH,
+                                         memory_order_acq_rel);
+  tb->back = old & 3;
+}
+
+static const Frame8080 *triple_take(TripleBuffer *tb) {
+  // The newest frame if there was one since the last call, else NULL. It
+  // stays the reader's until the next call.
+  if (!(atomic_load_explicit(&tb->middle, memory_order_relaxed) &
+        TRIPLE_FRESH))
+    return NULL;
+  uint8_t old = atomic_exchange_explicit(&tb->middle, tb->front,
+                                         memory_order_acq_rel);
+  tb->front = old & 3;
+  return &tb->frames[tb->front];
+}
+
+// Host input for the board's input ports: `bits` of port `port` go high
+// (down) or low, before frame `frame` runs (0 for as soon as possible)
+typedef struct InputEvent {
+  uint32_t frame;
+  uint8_t port;
+  uint8_t bits;
+  uint8_t down;
+} InputEvent;
+
+// Single-producer, single-consumer ring of InputEvents, from the host to
+// emulate(). Neither end loops or waits.
+#define INPUT_QUEUE_SIZE 64 // a power of two
+typedef struct InputQueue {
+  InputEvent events[INPUT_QUEUE_SIZE];
+  _Atomic uint32_t head; // moved by the host
+  _Atomic uint32_t tail; // moved by emulate()
+} InputQueue;
+
+static int input_push(InputQueue *q, InputEvent e) {
+  // Returns 0 if the queue is full
+  uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&q->tail, memory_order_acquire) ==
+      INPUT_QUEUE_SIZE)
+    return 0;
+  q->events[head % INPUT_QUEUE_SIZE] = e;
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  return 1;
+}
+
+static const InputEvent *input_peek(InputQueue *q) {
+  // The oldest event, NULL if there is none. input_pop() drops it.
+  uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  if (tail == atomic_load_explicit(&q->head, memory_order_acquire))
+    return NULL;
+  return &q->events[tail % INPUT_QUEUE_SIZE];
+}
+
+static void input_pop(InputQueue *q) {
+  uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+// Frame pacing. Each frame is due when the wall clock reaches the time
+// its last emulated cycle stands for, counted from a base instant, and
+// emulate() sleeps until then with clock_nanosleep() on that absolute
+// deadline. Oversleeping one frame shortens the next sleep, so drift does
+// not add up. A host falling further behind than PACE_RESYNC_NS (a stall,
+// a suspended process) moves the base up instead of racing to catch up.
+// In turbo mode nothing sleeps.
+#define NS_PER_SECOND 1000000000ull
+#define PACE_RESYNC_NS (NS_PER_SECOND / 10)
+
+typedef struct Pacer {
+  int turbo;
+  uint64_t base_ns;     // wall clock at base_cycles
+  uint64_t base_cycles; // emulated clock at base_ns
+  uint64_t last_ns;     // when the last frame was let go, 0 before the first
+  uint64_t last_cycles;
+  // For pace_report(): wall and emulated time of the frames, how far each
+  // frame's wall time was from its emulated time, and how late wakeups were
+  uint64_t frames, resyncs;
+  uint64_t wall_ns, emulated_ns, jitter_sum, jitter_max, late_max;
+} Pacer;
+
+static uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+static uint64_t cycles_to_ns(uint64_t cycles) {
+  // Split so that hours of cycles do not overflow
+  return cycles / CPU_CLOCK_HZ * NS_PER_SECOND +
+         cycles % CPU_CLOCK_HZ * NS_PER_SECOND / CPU_CLOCK_HZ;
+}
+
+static void pace(Pacer *p, uint64_t cycles) {
+  // Called with the emulated clock after each frame, returns when the
+  // frame is due
+  uint64_t now = monotonic_ns();
+  if (p->last_ns == 0) {
+    p->base_ns = now;
+    p->base_cycles = cycles;
+  } else if (!p->turbo) {
+    uint64_t due = p->base_ns + cycles_to_ns(cycles - p->base_cycles);
+    if (now > due + PACE_RESYNC_NS) {
+      p->base_ns = now;
+      p->base_cycles = cycles;
+      p->resyncs++;
+    } else if (now < due) {
+      struct timespec ts = {due / NS_PER_SECOND, due % NS_PER_SECOND};
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ; // interrupted by a signal
+      now = monotonic_ns();
+      if (now - due > p->late_max)
+        p->late_max = now - due;
+    }
+  }
+  if (p->last_ns != 0) {
+    uint64_t wall = now - p->last_ns;
+    uint64_t emulated = cycles_to_ns(cycles - p->last_cycles);
+    uint64_t jitter = wall > emulated ? wall - emulated : emulated - wall;
+    p->wall_ns += wall;
+    p->emulated_ns += emulated;
+    p->jitter_sum += jitter;
+    if (jitter > p->jitter_max)
+      p->jitter_max = jitter;
+    p->frames++;
+  }
+  p->last_ns = now;
+  p->last_cycles = cycles;
+}
+
+static void pace_report(const Pacer *p) {
+  if (p->frames == 0)
+    return;
+  double frame_ns = (double)p->wall_ns / p->frames;
+  printf("%s: %.3f ms/frame, %.2f fps, %.3fx real time\n",
+         p->turbo ? "turbo" : "paced", frame_ns / 1e6, 1e9 / frame_ns,
+         (double)p->emulated_ns / p->wall_ns);
+  if (!p->turbo)
+    printf("jitter: %.1f us mean, %.1f us max, latest wakeup %.1f us, "
+           "%llu resyncs\n",
+           (double)p->jitter_sum / p->frames / 1e3, p->jitter_max / 1e3,
+           p->late_max / 1e3, (unsigned long long)p->resyncs);
+}
+
+// Run-ahead (-r). After each frame emulate() saves the machine, runs
+// `frames` more on the input as it stands, publishes the last of them in
+// place of the real one and goes back to the snapshot. Input then shows on
+// screen that many frames sooner, for that many frames' more emulation per
+// frame. The capture still gets the real frames.
+typedef struct RunAhead {
+  int frames; // 0 for off
+  Snapshot8080 snapshot;
+  // For run_ahead_report(): per real frame, the time spent on the frame
+  // itself, saving, running ahead and restoring
+  uint64_t runs, frame_ns, save_ns, ahead_ns, restore_ns;
+} RunAhead;
+#define RUN_AHEAD_MAX 8
+
+static void run_ahead(RunAhead *r, State8080 *state, Invaders *board,
+                      uint8_t *vram, uint64_t frame_start) {
+  // Called after a frame ran from `frame_start`, leaves the video RAM of
+  // the frame `frames` ahead in `vram`. main() allocated the snapshot.
+  uint64_t save = monotonic_ns();
+  Invaders device = *board;
+  save_state(state, &r->snapshot);
+  uint64_t ahead = monotonic_ns();
+  for (int i = 0; i < r->frames; i++)
+    run_until(state, state->events.now + CYCLES_PER_FRAME);
+  memcpy(vram, state->memory + state->video_start, VRAM_SIZE);
+  uint64_t restore = monotonic_ns();
+  restore_state(state, &r->snapshot);
+  *board = device;
+  uint64_t done = monotonic_ns();
+  r->frame_ns += save - frame_start;
+  r->save_ns += ahead - save;
+  r->ahead_ns += restore - ahead;
+  r->restore_ns += done - restore;
+  r->runs++;
+}
+
+static void run_ahead_report(const RunAhead *r) {
+  if (r->runs == 0)
+    return;
+  double runs = r->runs;
+  printf("run-ahead %d: frame %.1f us, save %.2f us, ahead %.1f us, "
+         "restore %.2f us per frame\n",
+         r->frames, r->frame_ns / runs / 1e3, r->save_ns / runs / 1e3,
+         r->ahead_ns / runs / 1e3, r->restore_ns / runs / 1e3);
+}
+
+typedef struct Emulator {
+  State8080 *state;
+  Invaders *board;
+  Capture *capture; // NULL unless capturing
+  uint64_t frames;  // how many to run, 0 for no end
+  Pacer pacer;
+  RunAhead ahead;
+  TripleBuffer out;
+  InputQueue in;
+  _Atomic int running;
+} Emulator;
+
+static void *emulate(void *arg) {
+  // The emulation thread: applies the input due, runs a frame, hands it
+  // to the capture and publishes it (or the one run-ahead reaches), and
+  // waits for the frame to be due, until `frames` have run
+  Emulator *emu = arg;
+  State8080 *state = emu->state;
+  for (uint64_t frame = 0; emu->frames == 0 || frame < emu->frames;
+       frame++) {
+    const InputEvent *e;
+    while ((e = input_peek(&emu->in)) != NULL && e->frame <= frame) {
+      if (e->port < sizeof(emu->board->inputs)) {
+        uint8_t *port = &emu->board->inputs[e->port];
+        *port = e->down ? *port | e->bits : *port & ~e->bits;
+      }
+      input_pop(&emu->in);
+    }
+    uint64_t start = monotonic_ns();
+    run_until(state, state->events.now + CYCLES_PER_FRAME);
+    if (emu->capture != NULL)
+      capture_frame(emu->capture, state);
+    Frame8080 *out = &emu->out.frames[emu->out.back];
+    out->number = frame;
+    if (emu->ahead.frames > 0)
+      run_ahead(&emu->ahead, state, emu->board, out->vram, start);
+    else
+      memcpy(out->vram, state->memory + state->video_start, VRAM_SIZE);
+    triple_publish(&emu->out);
+    pace(&emu->pacer, state->events.now);
+  }
+  atomic_store_explicit(&emu->running, 0, memory_order_release);
+  return NULL;
+}
+
+// Host input as lines on stdin, "[frame] +name" to press and "-name" to
+// let go, the frame saying when for scripted runs
+static const struct {
+  const char *name;
+  uint8_t port, bits;
+} input_names[] = {
+    {"coin", 1, INVADERS_COIN},    {"start1", 1, INVADERS_P1_START},
+    {"start2", 1, INVADERS_P2_START}, {"fire", 1, INVADERS_FIRE},
+    {"left", 1, INVADERS_LEFT},    {"right", 1, INVADERS_RIGHT},
+    {"fire2", 2, INVADERS_FIRE},   {"left2", 2, INVADERS_LEFT},
+    {"right2", 2, INVADERS_RIGHT},
+};
+#define HOST_IDLE_NS 1000000
+
+static int parse_input(const char *line, InputEvent *e) {
+  // Returns 0 if `line` is not an input line
+  char sign, name[16];
+  unsigned frame = 0;
+  if (sscanf(line, "%u %c%15s", &frame, &sign, name) != 3) {
+    frame = 0;
+    if (sscanf(line, " %c%15s", &sign, name) != 2)
+      return 0;
+  }
+  if (sign != '+' && sign != '-')
+    return 0;
+  for (size_t i = 0; i < sizeof(input_names) / sizeof(input_names[0]); i++) {
+    if (strcmp(name, input_names[i].name) == 0) {
+      e->frame = frame;
+      e->port = input_names[i].port;
+      e->bits = input_names[i].bits;
+      e->down = sign == '+';
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void *read_input(void *arg) {
+  // The input thread: stdin lines into the queue, waiting for room when
+  // a script runs ahead of the game
+  Emulator *emu = arg;
+  const struct timespec idle = {0, HOST_IDLE_NS};
+  char line[128];
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    InputEvent e;
+    if (!parse_input(line, &e)) {
+      fprintf(stderr, "input: cannot read %s", line);
+      continue;
+    }
+    while (!input_push(&emu->in, e))
+      nanosleep(&idle, NULL);
+  }
+  return NULL;
+}
+
+// What a display would show: the newest frame, rendered through the
+// overlay, whenever one came since the last look
+typedef struct Presenter {
+  ScreenRows rows;
+  uint32_t overlay[SCREEN_WIDTH * SCREEN_HEIGHT];
+  uint32_t screen[SCREEN_WIDTH * SCREEN_HEIGHT];
+  uint64_t presented, last;
+} Presenter;
+
+static void present(Presenter *p, const Frame8080 *frame) {
+  video_rows(frame->vram, p->rows, VIDEO_ALL_GROUPS);
+  video_rgba((const uint8_t(*)[SCREEN_ROW_BYTES])p->rows, p->overlay,
+             VIDEO_ALL_GROUPS, p->screen);
+  p->last = frame->number;
+  p->presented++;
+}
+
+static void run_host(Emulator *emu) {
+  // Runs `emu` on threads of its own and presents its frames from this
+  // one until it has run all it was asked to
+  static Presenter p;
+  video_overlay_invaders(p.overlay, NULL);
+  const struct timespec idle = {0, HOST_IDLE_NS};
+  pthread_t emulation, input;
+  triple_init(&emu->out);
+  atomic_init(&emu->running, 1);
+  if (pthread_create(&emulation, NULL, emulate, emu) != 0) {
+    printf("Error: could not start the emulation thread\n");
+    exit(1);
+  }
+  // Blocked in fgets() for as long as stdin is open, never joined
+  if (pthread_create(&input, NULL, read_input, emu) == 0)
+    pthread_detach(input);
+  for (;;) {
+    int running = atomic_load_explicit(&emu->running, memory_order_acquire);
+    const Frame8080 *frame = triple_take(&emu->out);
+    if (frame != NULL)
+      present(&p, frame);
+    else if (!running)
+      break;
+    else
+      nanosleep(&idle, NULL);
+  }
+  pthread_join(emulation, NULL);
+  pace_report(&emu->pacer);
+  run_ahead_report(&emu->ahead);
+  // Frames newer ones replaced before they could be shown
+  uint64_t skipped = p.presented ? p.last + 1 - p.presented : 0;
+  printf("presented %llu frames, %llu skipped\n",
+         (unsigned long long)p.presented, (unsigned long long)skipped);
+}
+
+int disassemble(unsigned char *buffer, int pc); // disassembler decl
+
+static void usage(const char *name) {
+  printf("Usage: %s <rom> [-d | [-t] [-r n] [-c <file> [frames]]] | -b", name);
+#ifdef JIT
+  printf(" | -j");
+#endif
+#ifdef STATIC_ROM
+  printf(" | -s");
+#endif
+  printf("\n");
+  exit(1);
+}
+
+static int parse_count(const char *s, unsigned long long max,
+                       unsigned long long *count) {
+  // A whole non-negative number no larger than `max`, 0 if `s` is not one
+  char *end;
+  if (*s < '0' || *s > '9')
+    return 0;
+  errno = 0;
+  *count = strtoull(s, &end, 10);
+  return *end == '\0' && errno == 0 && *count <= max;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2)
+    usage(argv[0]);
+  if (strcmp(argv[1], "-b") == 0) {
+    benchmark();
+    return 0;
+  }
+#ifdef JIT
+  if (strcmp(argv[1], "-j") == 0)
+    return jit_crosscheck();
+#endif
+#ifdef STATIC_ROM
+  if (strcmp(argv[1], "-s") == 0)
+    return static_crosscheck() || static_idle_check();
+#endif
+  if (argv[1][0] == '-') {
+    printf("Error: unknown option %s\n", argv[1]);
+    usage(argv[0]);
+  }
+  // Options follow the ROM in any order: -d disassembles it instead, -t
+  // runs as fast as the host goes instead of at 60 frames a second, -r
+  // shows frames that many ahead of the input, and -c writes every frame
+  // to a file and, given a count, stops after that many
+  int disasm = 0, turbo = 0, ahead = 0;
+  const char *capture_path = NULL;
+  uint64_t frames = 0;
+  for (int arg = 2; arg < argc; arg++) {
+    unsigned long long n;
+    if (strcmp(argv[arg], "-d") == 0) {
+      disasm = 1;
+    } else if (strcmp(argv[arg], "-t") == 0) {
+      turbo = 1;
+    } else if (strcmp(argv[arg], "-r") == 0) {
+      if (arg + 1 == argc || !parse_count(argv[++arg], RUN_AHEAD_MAX, &n)) {
+        printf("Error: can run 0 to %d frames ahead\n", RUN_AHEAD_MAX);
+        usage(argv[0]);
+      }
+      ahead = (int)n;
+    } else if (strcmp(argv[arg], "-c") == 0) {
+      if (arg + 1 == argc)
+        usage(argv[0]);
+      capture_path = argv[++arg];
+      if (arg + 1 < argc && argv[arg + 1][0] != '-') {
+        if (!parse_count(argv[++arg], UINT64_MAX, &n)) {
+          printf("Error: %s is not a frame count\n", argv[arg]);
+          usage(argv[0]);
+        }
+        frames = n;
+      }
+    } else {
+      printf("Error: unknown option %s\n", argv[arg]);
+      usage(argv[0]);
+    }
+  }
+  if (disasm && (turbo || ahead || capture_path != NULL))
+    usage(argv[0]);
+
+  FILE *f = fopen(argv[1], "rb");
+  if (f == NULL) {
+    printf("Error: could not open %s\n", argv[1]);
+    exit(1);
+  }
+  // Read code into into buffer
+  fseek(f, 0L, SEEK_END);
+  int fsize = ftell(f); // grabbing total file size
+  fseek(f, 0L, SEEK_SET);
+  if (fsize > MEMORY_SIZE)
+    fsize = MEMORY_SIZE; // the 8080 can only address 64K
+  unsigned char *buffer = alloc_memory();
+  if (buffer == NULL) {
+    printf("Error: out of memory\n");
+    exit(1);
+  }
+  fread(buffer, fsize, 1, f);
+  fclose(f);
+
+  if (disasm) {
+    // Perform Disassembly
+    int pc = 0;
+    while (pc < fsize) {
+      pc += disassemble(buffer, pc);
+    }
+    return 0;
+  }
+
+  Capture *capture = NULL;
+  if (capture_path != NULL) {
+    capture = capture_open(capture_path);
+    if (capture == NULL) {
+      printf("Error: could not capture to %s\n", capture_path);
+      exit(1);
+    }
+  }
+
+  // Run the program from the reset vector
+  State8080 *state = aligned_alloc(_Alignof(State8080), sizeof(State8080));
+  if (state == NULL) {
+    printf("Error: out of memory\n");
+    exit(1);
+  }
+  memset(state, 0, sizeof(State8080));
+  attach_memory(state, buffer);
+  Invaders *board = machine_init(state);
+  if (board == NULL) {
+    printf("Error: out of memory\n");
+    exit(1);
+  }
+#ifdef STATIC_ROM
+  if (!static_rom_enable(state))
+    printf("%s is not the ROM built in, running it interpreted\n", argv[1]);
+#endif
+#ifdef JIT
+  jit_enable(state);
+#endif
+  static Emulator emu;
+  emu.state = state;
+  emu.board = board;
+  emu.capture = capture;
+  emu.frames = frames;
+  emu.pacer.turbo = turbo;
+  emu.ahead.frames = ahead;
+  if (ahead > 0 && (emu.ahead.snapshot.memory = alloc_memory()) == NULL) {
+    printf("Error: out of memory\n");
+    exit(1);
+  }
+  run_host(&emu);
+#ifdef JIT
+  jit_report(state);
+#endif
+
+  if (capture != NULL && !capture_close(capture))
+    return 1;
+  return 0;
+}
+
+int disassemble(unsigned char *buffer, int pc) {
+  // Prints the instruction at `pc` from the opcode tables, returns its
+  // length
+  uint8_t *opcode = &buffer[pc];
+  const char *sep = "\t";
+  printf("%04x %s", pc, mnemonic8080[*opcode]);
+  if (operands8080[*opcode][0] != '\0') {
+    printf("\t%s", operands8080[*opcode]);
+    sep = ", ";
+  }
+  switch (operand8080[*opcode]) {
+  case OPERAND_IMM8:
+  case OPERAND_PORT:
+    printf("%s#$%02x", sep, opcode[1]);
     break;
-  case 0xff:
-    printf("RST\t7");
+  case OPERAND_IMM16:
+    printf("%s#$%02x%02x", sep, opcode[2], opcode[1]);
     break;
-
-  default: // Unknown instruction handling
-    printf("Unknown Instruction: 0x%02x", *opcode);
+  case OPERAND_ADDR:
+    printf("%s$%02x%02x", sep, opcode[2], opcode[1]);
     break;
   }
   printf("\n");
-  return opbytes;
+  return length8080[*opcode];
 }
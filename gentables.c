@@ -0,0 +1,331 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Table generator: reads the InstructionSet file and writes opcodes8080.h,
+// the per-opcode tables (mnemonic, operand text, length, cycles, flags
+// affected, operand kind, block end) that 8080em.c, disassembler.c and
+// recompiler.c decode with.
+//
+//	./gentables InstructionSet > opcodes8080.h
+//
+// Each line of InstructionSet gives an encoding with its variable fields
+// spelled out (DDD, SSS, RP, CCC, NNN), and is expanded here into every
+// opcode it matches. Encodings with no fields override the patterns they
+// overlap, so HLT wins over MOV M,M.
+
+static const char *reg_names[8] = {"B", "C", "D", "E", "H", "L", "M", "A"};
+static const char *pair_names[4] = {"B", "D", "H", "SP"};
+static const char *cond_names[8] = {"NZ", "Z", "NC", "C",
+                                    "PO", "PE", "P", "M"};
+
+enum { OPERAND_NONE, OPERAND_IMM8, OPERAND_IMM16, OPERAND_ADDR, OPERAND_PORT };
+static const char *operand_kinds[] = {"OPERAND_NONE", "OPERAND_IMM8",
+                                      "OPERAND_IMM16", "OPERAND_ADDR",
+                                      "OPERAND_PORT"};
+
+// Instructions after which the next one to run is not simply the one
+// that follows: jumps, calls, returns, restarts and HLT
+static const char *block_enders[] = {"JMP",  "Jccc", "CALL", "Cccc", "RET",
+                                     "Rccc", "RST",  "PCHL", "HLT"};
+
+typedef struct {
+  char mnemonic[8];
+  char operands[8];
+  uint8_t length, cycles, flags, operand, ends_block;
+  uint8_t fixed; // from an encoding without fields
+  uint8_t defined;
+} Entry;
+
+static Entry table[256];
+static int line_no;
+static int cond_taken; // extra cycles of a taken conditional CALL/RET
+
+static void fail(const char *what) {
+  fprintf(stderr, "InstructionSet:%d: %s\n", line_no, what);
+  exit(1);
+}
+
+static void field(const char *line, int from, int to, char *out, int size) {
+  // Copies columns [from, to) of `line` without the surrounding blanks
+  int len = strlen(line);
+  if (to > len)
+    to = len;
+  while (from < to && line[from] == ' ')
+    from++;
+  while (to > from && (line[to - 1] == ' ' || line[to - 1] == '\n'))
+    to--;
+  int n = to > from ? to - from : 0;
+  if (n >= size)
+    n = size - 1; // only on lines that are not table rows
+  memcpy(out, line + from, n);
+  out[n] = '\0';
+}
+
+static uint8_t parse_flags(const char *text) {
+  // Letters from ZSPCA in PSW bit positions
+  uint8_t flags = 0;
+  for (; *text; text++) {
+    switch (*text) {
+    case 'Z':
+      flags |= 0x40;
+      break;
+    case 'S':
+      flags |= 0x80;
+      break;
+    case 'P':
+      flags |= 0x04;
+      break;
+    case 'C':
+      flags |= 0x01;
+      break;
+    case 'A':
+      flags |= 0x10;
+      break;
+    }
+  }
+  return flags;
+}
+
+static int matches(const char *pattern, int op, int *ddd, int *sss, int *rp,
+                   int *ccc) {
+  // Checks `op` against an encoding like 01DDDSSS and pulls out its fields
+  *ddd = *sss = *rp = *ccc = -1;
+  for (int bit = 0; bit < 8; bit++) {
+    int value = (op >> (7 - bit)) & 1;
+    switch (pattern[bit]) {
+    case '0':
+    case '1':
+      if (value != pattern[bit] - '0')
+        return 0;
+      break;
+    case 'D':
+      *ddd = (*ddd < 0 ? 0 : *ddd) << 1 | value;
+      break;
+    case 'S':
+      *sss = (*sss < 0 ? 0 : *sss) << 1 | value;
+      break;
+    case 'R':
+    case 'P':
+      *rp = (*rp < 0 ? 0 : *rp) << 1 | value;
+      break;
+    case 'C':
+    case 'N':
+      *ccc = (*ccc < 0 ? 0 : *ccc) << 1 | value;
+      break;
+    default:
+      fail("bad encoding");
+    }
+  }
+  return 1;
+}
+
+static void parse_line(const char *line) {
+  char inst[16], encoding[24], flags[8], cycles[8];
+  field(line, 0, 10, inst, sizeof(inst));
+  field(line, 10, 28, encoding, sizeof(encoding));
+  field(line, 28, 36, flags, sizeof(flags));
+  field(line, 36, 44, cycles, sizeof(cycles));
+  if (strlen(encoding) < 8 || strspn(encoding, "01DSRPCN") < 8)
+    return; // header, rule or notes
+
+  char mnemonic[8], args[8] = "";
+  char *space = strchr(inst, ' ');
+  if (space != NULL) {
+    strcpy(args, space + 1);
+    *space = '\0';
+  }
+  strcpy(mnemonic, inst);
+
+  int length = 1, operand = OPERAND_NONE;
+  if (strstr(encoding, " db") || strstr(encoding, " pa"))
+    length = 2;
+  if (strstr(encoding, " lb hb"))
+    length = 3;
+  if (strchr(args, '#'))
+    operand = length == 3 ? OPERAND_IMM16 : OPERAND_IMM8;
+  else if (strchr(args, 'a'))
+    operand = OPERAND_ADDR;
+  else if (strchr(args, 'p'))
+    operand = OPERAND_PORT;
+
+  int cycles_short = atoi(cycles), cycles_long = cycles_short;
+  if (strchr(cycles, '/'))
+    cycles_long = atoi(strchr(cycles, '/') + 1);
+  if (cycles_short == 0)
+    fail("missing cycles");
+
+  int ends_block = 0;
+  for (size_t i = 0; i < sizeof(block_enders) / sizeof(block_enders[0]); i++)
+    ends_block |= strcmp(mnemonic, block_enders[i]) == 0;
+
+  int fixed = strspn(encoding, "01") >= 8;
+  int pairs_psw = strstr(encoding, "*2") != NULL;
+  int pairs_bd = strstr(encoding, "*1") != NULL;
+  int nonzero = strstr(encoding, "*3") != NULL;
+  int found = 0;
+  for (int op = 0; op < 256; op++) {
+    int ddd, sss, rp, ccc;
+    if (!matches(encoding, op, &ddd, &sss, &rp, &ccc))
+      continue;
+    if (pairs_bd && rp > 1)
+      continue;
+    if (nonzero && ccc == 0)
+      continue;
+    Entry *e = &table[op];
+    if (e->defined && (e->fixed || !fixed))
+      fail("encoding overlaps an earlier line");
+    memset(e, 0, sizeof(*e));
+    e->defined = 1;
+    e->fixed = fixed;
+    e->length = length;
+    e->operand = operand;
+    e->ends_block = ends_block;
+    e->flags = parse_flags(flags);
+    if (strcmp(flags, "*2") == 0)
+      e->flags = rp == 3 ? parse_flags("ZSPCA") : 0;
+
+    // Conditions are part of the mnemonic (Jccc -> JNZ), the rest of the
+    // fields become the operand text
+    char *cc = strstr(mnemonic, "ccc");
+    if (cc != NULL)
+      snprintf(e->mnemonic, sizeof(e->mnemonic), "%.*s%s",
+               (int)(cc - mnemonic), mnemonic, cond_names[ccc]);
+    else
+      strcpy(e->mnemonic, mnemonic);
+    for (char *arg = args; *arg;) {
+      size_t n = strcspn(arg, ",");
+      char text[4] = "";
+      if (strncmp(arg, "D", n) == 0)
+        strcpy(text, reg_names[ddd]);
+      else if (strncmp(arg, "S", n) == 0)
+        strcpy(text, reg_names[sss]);
+      else if (strncmp(arg, "RP", n) == 0)
+        strcpy(text, rp == 3 && pairs_psw ? "PSW" : pair_names[rp]);
+      else if (strncmp(arg, "n", n) == 0)
+        snprintf(text, sizeof(text), "%d", ccc);
+      if (text[0]) {
+        if (e->operands[0])
+          strcat(e->operands, ",");
+        strcat(e->operands, text);
+      }
+      arg += n;
+      if (*arg == ',')
+        arg++;
+    }
+    // The long cycle count is for the M form, or for a taken conditional
+    // call or return. The table keeps the untaken cost of those, and what
+    // taking them adds becomes CYCLES_COND_TAKEN.
+    if (cc != NULL && cycles_long != cycles_short) {
+      if (cond_taken != 0 && cond_taken != cycles_long - cycles_short)
+        fail("conditional calls and returns differ in taken cost");
+      cond_taken = cycles_long - cycles_short;
+    }
+    e->cycles = ddd == 6 || sss == 6 ? cycles_long : cycles_short;
+    found++;
+  }
+  if (found == 0)
+    fail("encoding matches no opcode");
+}
+
+static void emit_bytes(const char *name, const char *comment, int which) {
+  printf("// %s\nstatic const uint8_t %s[256] = {\n", comment, name);
+  for (int row = 0; row < 256; row += 16) {
+    printf("   ");
+    for (int op = row; op < row + 16; op++) {
+      const Entry *e = &table[op];
+      int v = which == 0   ? e->length
+              : which == 1 ? e->cycles
+              : which == 2 ? e->flags
+                           : e->ends_block;
+      if (which == 2)
+        printf(" 0x%02x,", v);
+      else
+        printf(" %2d,", v);
+    }
+    printf(" // 0x%02x\n", row);
+  }
+  printf("};\n\n");
+}
+
+static void emit_strings(const char *name, const char *comment, int which) {
+  printf("// %s\nstatic const char *const %s[256] = {\n", comment, name);
+  for (int row = 0; row < 256; row += 8) {
+    printf("   ");
+    for (int op = row; op < row + 8; op++) {
+      const Entry *e = &table[op];
+      printf(" \"%s\",", which == 0 ? e->mnemonic : e->operands);
+    }
+    printf(" // 0x%02x\n", row);
+  }
+  printf("};\n\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: %s InstructionSet > opcodes8080.h\n", argv[0]);
+    exit(1);
+  }
+  FILE *f = fopen(argv[1], "r");
+  if (f == NULL) {
+    printf("Error: could not open %s\n", argv[1]);
+    exit(1);
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    line_no++;
+    parse_line(line);
+  }
+  fclose(f);
+  for (int op = 0; op < 256; op++) {
+    if (!table[op].defined) {
+      fprintf(stderr, "%s: no line covers opcode 0x%02x\n", argv[1], op);
+      exit(1);
+    }
+  }
+
+  printf("// Generated by gentables from InstructionSet, do not edit.\n\n"
+         "#ifndef OPCODES8080_H\n"
+         "#define OPCODES8080_H\n\n"
+         "#include <stdint.h>\n\n"
+         "// Flag bits as they sit in the 8080 PSW byte\n"
+         "#define FLAG_S 0x80\n"
+         "#define FLAG_Z 0x40\n"
+         "#define FLAG_AC 0x10\n"
+         "#define FLAG_P 0x04\n"
+         "#define FLAG_CY 0x01\n\n"
+         "// What the bytes after the opcode are\n"
+         "enum {\n");
+  for (int k = 0; k <= OPERAND_PORT; k++)
+    printf("  %s,\n", operand_kinds[k]);
+  printf("};\n\n");
+  emit_strings("mnemonic8080", "Mnemonic, with the condition for Jcc/Ccc/Rcc",
+               0);
+  emit_strings("operands8080",
+               "Register, pair or restart operands, immediates not included",
+               1);
+  emit_bytes("length8080", "Instruction length in bytes, opcode plus operands",
+             0);
+  emit_bytes("cycles8080",
+             "Cycles (T-states) per opcode. Conditional CALL and RET list the "
+             "cost of\n// the untaken case, a taken one costs "
+             "CYCLES_COND_TAKEN more.",
+             1);
+  printf("#define CYCLES_COND_TAKEN %d\n\n", cond_taken);
+  emit_bytes("flags8080", "Flags each opcode sets, FLAG_* bits", 2);
+  emit_bytes("block_end8080",
+             "1 if the opcode ends a basic block: jumps, calls, returns, RST, "
+             "PCHL and HLT",
+             3);
+  printf("// Operand kind, OPERAND_*\nstatic const uint8_t operand8080[256] = "
+         "{\n");
+  for (int row = 0; row < 256; row += 16) {
+    printf("   ");
+    for (int op = row; op < row + 16; op++)
+      printf(" %d,", table[op].operand);
+    printf(" // 0x%02x\n", row);
+  }
+  printf("};\n\n#endif\n");
+  return 0;
+}
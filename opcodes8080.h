@@ -0,0 +1,199 @@
+// Generated by gentables from InstructionSet, do not edit.
+
+#ifndef OPCODES8080_H
+#define OPCODES8080_H
+
+#include <stdint.h>
+
+// Flag bits as they sit in the 8080 PSW byte
+#define FLAG_S 0x80
+#define FLAG_Z 0x40
+#define FLAG_AC 0x10
+#define FLAG_P 0x04
+#define FLAG_CY 0x01
+
+// What the bytes after the opcode are
+enum {
+  OPERAND_NONE,
+  OPERAND_IMM8,
+  OPERAND_IMM16,
+  OPERAND_ADDR,
+  OPERAND_PORT,
+};
+
+// Mnemonic, with the condition for Jcc/Ccc/Rcc
+static const char *const mnemonic8080[256] = {
+    "NOP", "LXI", "STAX", "INX", "INR", "DCR", "MVI", "RLC", // 0x00
+    "NOP", "DAD", "LDAX", "DCX", "INR", "DCR", "MVI", "RRC", // 0x08
+    "NOP", "LXI", "STAX", "INX", "INR", "DCR", "MVI", "RAL", // 0x10
+    "NOP", "DAD", "LDAX", "DCX", "INR", "DCR", "MVI", "RAR", // 0x18
+    "NOP", "LXI", "SHLD", "INX", "INR", "DCR", "MVI", "DAA", // 0x20
+    "NOP", "DAD", "LHLD", "DCX", "INR", "DCR", "MVI", "CMA", // 0x28
+    "NOP", "LXI", "STA", "INX", "INR", "DCR", "MVI", "STC", // 0x30
+    "NOP", "DAD", "LDA", "DCX", "INR", "DCR", "MVI", "CMC", // 0x38
+    "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", // 0x40
+    "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", // 0x48
+    "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", // 0x50
+    "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", // 0x58
+    "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", // 0x60
+    "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", // 0x68
+    "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "HLT", "MOV", // 0x70
+    "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", "MOV", // 0x78
+    "ADD", "ADD", "ADD", "ADD", "ADD", "ADD", "ADD", "ADD", // 0x80
+    "ADC", "ADC", "ADC", "ADC", "ADC", "ADC", "ADC", "ADC", // 0x88
+    "SUB", "SUB", "SUB", "SUB", "SUB", "SUB", "SUB", "SUB", // 0x90
+    "SBB", "SBB", "SBB", "SBB", "SBB", "SBB", "SBB", "SBB", // 0x98
+    "ANA", "ANA", "ANA", "ANA", "ANA", "ANA", "ANA", "ANA", // 0xa0
+    "XRA", "XRA", "XRA", "XRA", "XRA", "XRA", "XRA", "XRA", // 0xa8
+    "ORA", "ORA", "ORA", "ORA", "ORA", "ORA", "ORA", "ORA", // 0xb0
+    "CMP", "CMP", "CMP", "CMP", "CMP", "CMP", "CMP", "CMP", // 0xb8
+    "RNZ", "POP", "JNZ", "JMP", "CNZ", "PUSH", "ADI", "RST", // 0xc0
+    "RZ", "RET", "JZ", "JMP", "CZ", "CALL", "ACI", "RST", // 0xc8
+    "RNC", "POP", "JNC", "OUT", "CNC", "PUSH", "SUI", "RST", // 0xd0
+    "RC", "RET", "JC", "IN", "CC", "CALL", "SBI", "RST", // 0xd8
+    "RPO", "POP", "JPO", "XTHL", "CPO", "PUSH", "ANI", "RST", // 0xe0
+    "RPE", "PCHL", "JPE", "XCHG", "CPE", "CALL", "XRI", "RST", // 0xe8
+    "RP", "POP", "JP", "DI", "CP", "PUSH", "ORI", "RST", // 0xf0
+    "RM", "SPHL", "JM", "EI", "CM", "CALL", "CPI", "RST", // 0xf8
+};
+
+// Register, pair or restart operands, immediates not included
+static const char *const operands8080[256] = {
+    "", "B", "B", "B", "B", "B", "B", "", // 0x00
+    "", "B", "B", "B", "C", "C", "C", "", // 0x08
+    "", "D", "D", "D", "D", "D", "D", "", // 0x10
+    "", "D", "D", "D", "E", "E", "E", "", // 0x18
+    "", "H", "", "H", "H", "H", "H", "", // 0x20
+    "", "H", "", "H", "L", "L", "L", "", // 0x28
+    "", "SP", "", "SP", "M", "M", "M", "", // 0x30
+    "", "SP", "", "SP", "A", "A", "A", "", // 0x38
+    "B,B", "B,C", "B,D", "B,E", "B,H", "B,L", "B,M", "B,A", // 0x40
+    "C,B", "C,C", "C,D", "C,E", "C,H", "C,L", "C,M", "C,A", // 0x48
+    "D,B", "D,C", "D,D", "D,E", "D,H", "D,L", "D,M", "D,A", // 0x50
+    "E,B", "E,C", "E,D", "E,E", "E,H", "E,L", "E,M", "E,A", // 0x58
+    "H,B", "H,C", "H,D", "H,E", "H,H", "H,L", "H,M", "H,A", // 0x60
+    "L,B", "L,C", "L,D", "L,E", "L,H", "L,L", "L,M", "L,A", // 0x68
+    "M,B", "M,C", "M,D", "M,E", "M,H", "M,L", "", "M,A", // 0x70
+    "A,B", "A,C", "A,D", "A,E", "A,H", "A,L", "A,M", "A,A", // 0x78
+    "B", "C", "D", "E", "H", "L", "M", "A", // 0x80
+    "B", "C", "D", "E", "H", "L", "M", "A", // 0x88
+    "B", "C", "D", "E", "H", "L", "M", "A", // 0x90
+    "B", "C", "D", "E", "H", "L", "M", "A", // 0x98
+    "B", "C", "D", "E", "H", "L", "M", "A", // 0xa0
+    "B", "C", "D", "E", "H", "L", "M", "A", // 0xa8
+    "B", "C", "D", "E", "H", "L", "M", "A", // 0xb0
+    "B", "C", "D", "E", "H", "L", "M", "A", // 0xb8
+    "", "B", "", "", "", "B", "", "0", // 0xc0
+    "", "", "", "", "", "", "", "1", // 0xc8
+    "", "D", "", "", "", "D", "", "2", // 0xd0
+    "", "", "", "", "", "", "", "3", // 0xd8
+    "", "H", "", "", "", "H", "", "4", // 0xe0
+    "", "", "", "", "", "", "", "5", // 0xe8
+    "", "PSW", "", "", "", "PSW", "", "6", // 0xf0
+    "", "", "", "", "", "", "", "7", // 0xf8
+};
+
+// Instruction length in bytes, opcode plus operands
+static const uint8_t length8080[256] = {
+     1,  3,  1,  1,  1,  1,  2,  1,  1,  1,  1,  1,  1,  1,  2,  1, // 0x00
+     1,  3,  1,  1,  1,  1,  2,  1,  1,  1,  1,  1,  1,  1,  2,  1, // 0x10
+     1,  3,  3,  1,  1,  1,  2,  1,  1,  1,  3,  1,  1,  1,  2,  1, // 0x20
+     1,  3,  3,  1,  1,  1,  2,  1,  1,  1,  3,  1,  1,  1,  2,  1, // 0x30
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 0x40
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 0x50
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 0x60
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 0x70
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 0x80
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 0x90
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 0xa0
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 0xb0
+     1,  1,  3,  3,  3,  1,  2,  1,  1,  1,  3,  3,  3,  3,  2,  1, // 0xc0
+     1,  1,  3,  2,  3,  1,  2,  1,  1,  1,  3,  2,  3,  3,  2,  1, // 0xd0
+     1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  3,  2,  1, // 0xe0
+     1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  3,  2,  1, // 0xf0
+};
+
+// Cycles (T-states) per opcode. Conditional CALL and RET list the cost of
+// the untaken case, a taken one costs CYCLES_COND_TAKEN more.
+static const uint8_t cycles8080[256] = {
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 0x00
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 0x10
+     4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4, // 0x20
+     4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4, // 0x30
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x40
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x50
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x60
+     7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5, // 0x70
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x80
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x90
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0xa0
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0xb0
+     5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11, // 0xc0
+     5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11, // 0xd0
+     5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  5, 11, 17,  7, 11, // 0xe0
+     5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11, // 0xf0
+};
+
+#define CYCLES_COND_TAKEN 6
+
+// Flags each opcode sets, FLAG_* bits
+static const uint8_t flags8080[256] = {
+    0x00, 0x00, 0x00, 0x00, 0xd4, 0xd4, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0xd4, 0xd4, 0x00, 0x01, // 0x00
+    0x00, 0x00, 0x00, 0x00, 0xd4, 0xd4, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0xd4, 0xd4, 0x00, 0x01, // 0x10
+    0x00, 0x00, 0x00, 0x00, 0xd4, 0xd4, 0x00, 0xd5, 0x00, 0x01, 0x00, 0x00, 0xd4, 0xd4, 0x00, 0x00, // 0x20
+    0x00, 0x00, 0x00, 0x00, 0xd4, 0xd4, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0xd4, 0xd4, 0x00, 0x01, // 0x30
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x40
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x50
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x60
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x70
+    0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, // 0x80
+    0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, // 0x90
+    0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, // 0xa0
+    0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, 0xd5, // 0xb0
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd5, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd5, 0x00, // 0xc0
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd5, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd5, 0x00, // 0xd0
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd5, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd5, 0x00, // 0xe0
+    0x00, 0xd5, 0x00, 0x00, 0x00, 0x00, 0xd5, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd5, 0x00, // 0xf0
+};
+
+// 1 if the opcode ends a basic block: jumps, calls, returns, RST, PCHL and HLT
+static const uint8_t block_end8080[256] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x00
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x10
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x20
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x30
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x40
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x50
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x60
+     0,  0,  0,  0,  0,  0,  1,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x70
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x80
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0x90
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0xa0
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 0xb0
+     1,  0,  1,  1,  1,  0,  0,  1,  1,  1,  1,  1,  1,  1,  0,  1, // 0xc0
+     1,  0,  1,  0,  1,  0,  0,  1,  1,  1,  1,  0,  1,  1,  0,  1, // 0xd0
+     1,  0,  1,  0,  1,  0,  0,  1,  1,  1,  1,  0,  1,  1,  0,  1, // 0xe0
+     1,  0,  1,  0,  1,  0,  0,  1,  1,  0,  1,  0,  1,  1,  0,  1, // 0xf0
+};
+
+// Operand kind, OPERAND_*
+static const uint8_t operand8080[256] = {
+    0, 2, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, // 0x00
+    0, 2, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, // 0x10
+    0, 2, 3, 0, 0, 0, 1, 0, 0, 0, 3, 0, 0, 0, 1, 0, // 0x20
+    0, 2, 3, 0, 0, 0, 1, 0, 0, 0, 3, 0, 0, 0, 1, 0, // 0x30
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x40
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x50
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x60
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x70
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x80
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x90
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0xa0
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0xb0
+    0, 0, 3, 3, 3, 0, 1, 0, 0, 0, 3, 3, 3, 3, 1, 0, // 0xc0
+    0, 0, 3, 4, 3, 0, 1, 0, 0, 0, 3, 4, 3, 3, 1, 0, // 0xd0
+    0, 0, 3, 0, 3, 0, 1, 0, 0, 0, 3, 0, 3, 3, 1, 0, // 0xe0
+    0, 0, 3, 0, 3, 0, 1, 0, 0, 0, 3, 0, 3, 3, 1, 0, // 0xf0
+};
+
+#endif
@@ -0,0 +1,561 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcodes8080.h"
+
+// Static recompiler: translates the code of a fixed ROM into C ahead of
+// time. Starting from the reset and RST vectors it follows every direct
+// jump, call and fall-through, and writes one function per basic block that
+// does to a State8080 what the interpreter in 8080em.c would. The output is
+// compiled into the emulator with
+//
+//	./recompiler invaders.rom > invaders.c
+//	cc -O2 -DSTATIC_ROM='"invaders.c"' -o 8080em 8080em.c
+//
+// Addresses only reached indirectly (PCHL, RET to a computed address) and
+// HLT are left to the interpreter, which also takes over if the code in ROM
+// gets overwritten: a block stops after the store that did it.
+// `./recompiler -t` translates a built-in ROM instead, for `8080em -s` to
+// check against the interpreter.
+
+#define MAX_BLOCK_INSTS 32
+
+static const char *reg_names[8] = {"state->b", "state->c", "state->d",
+                                   "state->e", "state->h", "state->l",
+                                   "read_mem(state, state->hl)", "state->a"};
+
+// Condition of Jcc/Ccc/Rcc as C, by bits 3-5 of the opcode
+static const char *cond_names[8] = {
+    "!(state->f & FLAG_Z)",  "state->f & FLAG_Z",  "!(state->f & FLAG_CY)",
+    "state->f & FLAG_CY",    "!(state->f & FLAG_P)", "state->f & FLAG_P",
+    "!(state->f & FLAG_S)",  "state->f & FLAG_S"};
+
+static const char *pair_names[4] = {"state->bc", "state->de", "state->hl",
+                                    "state->sp"};
+
+static int translatable(uint8_t op) {
+  // Opcodes with a C translation. HLT parks the CPU until an interrupt,
+  // which only the interpreter's loop knows how to wait for.
+  return op != 0x76;
+}
+
+static uint8_t *rom;
+static int rom_size;
+static uint8_t is_block[0x10000];
+static uint16_t worklist[0x10000];
+static int pending;
+
+static void add_block(int addr) {
+  if (addr < rom_size && !is_block[addr]) {
+    is_block[addr] = 1;
+    worklist[pending++] = addr;
+  }
+}
+
+static int block_length(int start, int *insts) {
+  // Bytes in the block at `start`: up to and including the first branch,
+  // stopping short of an opcode the translator does not know or the end of
+  // the ROM
+  int pc = start, n = 0;
+  while (n < MAX_BLOCK_INSTS && pc < rom_size) {
+    uint8_t op = rom[pc];
+    if (!translatable(op) || pc + length8080[op] > rom_size)
+      break;
+    pc += length8080[op];
+    n++;
+    if (block_end8080[op])
+      break;
+  }
+  *insts = n;
+  return pc - start;
+}
+
+static int has_target(uint8_t op) {
+  // Jcc, Ccc, JMP, CALL and their undocumented twins
+  return (op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4 || op == 0xc3 ||
+         op == 0xcb || (op & 0xcf) == 0xcd;
+}
+
+static int falls_through(uint8_t op) {
+  // Whether the next instruction can run after `op`, straight away or on
+  // the return from a call
+  return op != 0xc3 && op != 0xcb && op != 0xc9 && op != 0xd9 && op != 0xe9;
+}
+
+static int stores(uint8_t op) {
+  // Whether `op` writes memory and lets the block go on after it. Those
+  // check whether the store overwrote translated code.
+  return (op >= 0x70 && op <= 0x77 && op != 0x76) || // MOV M, r
+         (op >= 0x34 && op <= 0x36) ||               // INR/DCR/MVI M
+         op == 0x02 || op == 0x12 ||                 // STAX
+         op == 0x22 || op == 0x32 ||                 // SHLD, STA
+         op == 0xe3 || (op & 0xcf) == 0xc5;          // XTHL, PUSH
+}
+
+static void find_blocks(void) {
+  // Marks every block reachable from the vectors through direct control
+  // flow. Returns from calls come back to the instruction after them, so
+  // those are block starts too. An instruction left to the interpreter
+  // ends the block before it, and the code after it is still followed.
+  for (int v = 0; v < 0x40; v += 8)
+    add_block(v);
+  while (pending > 0) {
+    int start = worklist[--pending], n;
+    int pc = start + block_length(start, &n);
+    if (n == 0) {
+      if (pc < rom_size && !translatable(rom[pc]))
+        add_block(pc + length8080[rom[pc]]);
+      continue;
+    }
+    int last = start;
+    while (last + length8080[rom[last]] < pc)
+      last += length8080[rom[last]];
+    uint8_t op = rom[last];
+    uint16_t target = rom[last + 1] | rom[(last + 2) & 0xffff] << 8;
+    if (has_target(op))
+      add_block(target);
+    if ((op & 0xc7) == 0xc7)
+      add_block(op & 0x38);
+    if (falls_through(op))
+      add_block(pc); // fall-through, return address or next chunk
+  }
+}
+
+static void emit_alu(FILE *out, int group, const char *src) {
+  // ADD ADC SUB SBB ANA XRA ORA CMP of `src` into A
+  switch (group) {
+  case 0:
+  case 1:
+    fprintf(out, "  state->a = alu_add(state, state->a, %s, %s);\n", src,
+            group == 1 ? "state->f & FLAG_CY" : "0");
+    break;
+  case 2:
+  case 3:
+    fprintf(out, "  state->a = alu_sub(state, state->a, %s, %s);\n", src,
+            group == 3 ? "state->f & FLAG_CY" : "0");
+    break;
+  case 4:
+    fprintf(out, "  state->a = alu_ana(state, state->a, %s);\n", src);
+    break;
+  case 5:
+  case 6:
+    fprintf(out, "  state->a = alu_logic(state, state->a %c %s);\n",
+            group == 5 ? '^' : '|', src);
+    break;
+  case 7:
+    fprintf(out, "  alu_sub(state, state->a, %s, 0);\n", src);
+    break;
+  }
+}
+
+static void emit_inst(FILE *out, int pc, uint8_t op, int *cycles) {
+  // Writes the C for one instruction. Branches end the function with pc
+  // and the cycle count, `cycles` includes this instruction.
+  uint16_t next = pc + length8080[op];
+  uint8_t imm8 = rom[pc + 1 < rom_size ? pc + 1 : pc];
+  uint16_t imm16 = imm8 | rom[pc + 2 < rom_size ? pc + 2 : pc] << 8;
+  const char *cond = cond_names[(op >> 3) & 7];
+  const char *pair = pair_names[(op >> 4) & 3];
+  int r = (op >> 3) & 7;
+  *cycles += cycles8080[op];
+
+  if (op >= 0x40 && op <= 0x7f) { // MOV, HLT is never translated
+    if (r == 6)
+      fprintf(out, "  stale |= write_mem(state, state->hl, %s);\n",
+              reg_names[op & 7]);
+    else
+      fprintf(out, "  %s = %s;\n", reg_names[r], reg_names[op & 7]);
+    return;
+  }
+  if (op >= 0x80 && op <= 0xbf) {
+    emit_alu(out, r, reg_names[op & 7]);
+    return;
+  }
+  if ((op & 0xc7) == 0xc6) { // ADI ACI SUI SBI ANI XRI ORI CPI
+    char imm[8];
+    snprintf(imm, sizeof(imm), "0x%02x", imm8);
+    emit_alu(out, r, imm);
+    return;
+  }
+  if ((op & 0xc6) == 0x04) {
+    const char *fn = op & 1 ? "alu_dcr" : "alu_inr";
+    if (r == 6)
+      fprintf(out, "  stale |= write_mem(state, state->hl, %s(state, %s));\n",
+              fn, reg_names[6]);
+    else
+      fprintf(out, "  %s = %s(state, %s);\n", reg_names[r], fn, reg_names[r]);
+    return;
+  }
+  if ((op & 0xc7) == 0x06) { // MVI
+    if (r == 6)
+      fprintf(out, "  stale |= write_mem(state, state->hl, 0x%02x);\n", imm8);
+    else
+      fprintf(out, "  %s = 0x%02x;\n", reg_names[r], imm8);
+    return;
+  }
+  switch (op & 0xcf) {
+  case 0x01: // LXI
+    fprintf(out, "  %s = 0x%04x;\n", pair, imm16);
+    return;
+  case 0x03: // INX
+    fprintf(out, "  %s++;\n", pair);
+    return;
+  case 0x0b: // DCX
+    fprintf(out, "  %s--;\n", pair);
+    return;
+  case 0x09: // DAD
+    fprintf(out,
+            "  {\n"
+            "    uint32_t res = state->hl + %s;\n"
+            "    state->hl = res;\n"
+            "    set_carry(state, res >> 16);\n"
+            "  }\n",
+            pair);
+    return;
+  case 0xc5: // PUSH
+    if (op == 0xf5)
+      fprintf(out, "  stale |= rom_push(state, state->a << 8 | "
+                   "psw_flags(state));\n");
+    else
+      fprintf(out, "  stale |= rom_push(state, %s);\n", pair);
+    return;
+  case 0xc1: // POP
+    if (op == 0xf1)
+      fprintf(out, "  {\n"
+                   "    uint16_t psw = rom_pop(state);\n"
+                   "    state->a = psw >> 8;\n"
+                   "    set_psw_flags(state, psw & 0xff);\n"
+                   "  }\n");
+    else
+      fprintf(out, "  %s = rom_pop(state);\n", pair);
+    return;
+  }
+  switch (op & 0xc7) {
+  case 0x00: // NOP and its undocumented twins
+    return;
+  case 0xc2: // Jcc
+    fprintf(out,
+            "  sync_flags(state);\n"
+            "  if (%s)\n    return rom_exit(state, 0x%04x, %d);\n"
+            "  return rom_exit(state, 0x%04x, %d);\n",
+            cond, imm16, *cycles, next, *cycles);
+    return;
+  case 0xc4: // Ccc
+    fprintf(out,
+            "  sync_flags(state);\n"
+            "  if (%s) {\n"
+            "    rom_push(state, 0x%04x);\n"
+            "    return rom_exit(state, 0x%04x, %d + CYCLES_COND_TAKEN);\n"
+            "  }\n"
+            "  return rom_exit(state, 0x%04x, %d);\n",
+            cond, next, imm16, *cycles, next, *cycles);
+    return;
+  case 0xc0: // Rcc
+    fprintf(out,
+            "  sync_flags(state);\n"
+            "  if (%s)\n"
+            "    return rom_exit(state, rom_pop(state), %d + "
+            "CYCLES_COND_TAKEN);\n"
+            "  return rom_exit(state, 0x%04x, %d);\n",
+            cond, *cycles, next, *cycles);
+    return;
+  case 0xc7: // RST
+    fprintf(out, "  rom_push(state, 0x%04x);\n", next);
+    fprintf(out, "  return rom_exit(state, 0x%04x, %d);\n", op & 0x38,
+            *cycles);
+    return;
+  }
+  switch (op) {
+  case 0x02: // STAX B/D
+  case 0x12:
+    fprintf(out, "  stale |= write_mem(state, %s, state->a);\n", pair);
+    break;
+  case 0x0a: // LDAX B/D
+  case 0x1a:
+    fprintf(out, "  state->a = read_mem(state, %s);\n", pair);
+    break;
+  case 0x22: // SHLD
+    fprintf(out, "  stale |= write_mem(state, 0x%04x, state->l);\n", imm16);
+    fprintf(out, "  stale |= write_mem(state, 0x%04x, state->h);\n",
+            (uint16_t)(imm16 + 1));
+    break;
+  case 0x2a: // LHLD
+    fprintf(out, "  state->hl = read_mem16(state, 0x%04x);\n", imm16);
+    break;
+  case 0x32: // STA
+    fprintf(out, "  stale |= write_mem(state, 0x%04x, state->a);\n", imm16);
+    break;
+  case 0x3a: // LDA
+    fprintf(out, "  state->a = read_mem(state, 0x%04x);\n", imm16);
+    break;
+  case 0x07: // RLC
+    fprintf(out, "  set_carry(state, state->a >> 7);\n"
+                 "  state->a = (state->a << 1) | (state->a >> 7);\n");
+    break;
+  case 0x0f: // RRC
+    fprintf(out, "  set_carry(state, state->a & 1);\n"
+                 "  state->a = (state->a >> 1) | (state->a << 7);\n");
+    break;
+  case 0x17: // RAL
+  case 0x1f: // RAR
+    fprintf(out,
+            "  {\n"
+            "    uint8_t carry = state->f & FLAG_CY;\n"
+            "    set_carry(state, %s);\n"
+            "    state->a = %s;\n"
+            "  }\n",
+            op == 0x17 ? "state->a >> 7" : "state->a & 1",
+            op == 0x17 ? "(state->a << 1) | carry"
+                       : "(state->a >> 1) | (carry << 7)");
+    break;
+  case 0x27: // DAA
+    fprintf(out, "  alu_daa(state);\n");
+    break;
+  case 0x2f: // CMA
+    fprintf(out, "  state->a = ~state->a;\n");
+    break;
+  case 0x37: // STC
+    fprintf(out, "  state->f |= FLAG_CY;\n");
+    break;
+  case 0x3f: // CMC
+    fprintf(out, "  state->f ^= FLAG_CY;\n");
+    break;
+  case 0xd3: // OUT
+    fprintf(out, "  port_out(state, 0x%02x, state->a);\n", imm8);
+    break;
+  case 0xdb: // IN
+    fprintf(out, "  state->a = port_in(state, 0x%02x);\n", imm8);
+    break;
+  case 0xe3: // XTHL
+    fprintf(out, "  {\n"
+                 "    uint16_t hl = read_mem16(state, state->sp);\n"
+                 "    stale |= write_mem(state, state->sp, state->l);\n"
+                 "    stale |= write_mem(state, state->sp + 1, state->h);\n"
+                 "    state->hl = hl;\n"
+                 "  }\n");
+    break;
+  case 0xeb: // XCHG
+    fprintf(out, "  {\n"
+                 "    uint16_t de = state->de;\n"
+                 "    state->de = state->hl;\n"
+                 "    state->hl = de;\n"
+                 "  }\n");
+    break;
+  case 0xf9: // SPHL
+    fprintf(out, "  state->sp = state->hl;\n");
+    break;
+  case 0xf3: // DI
+  case 0xfb: // EI
+    fprintf(out, "  state->int_enable = %d;\n", op == 0xfb);
+    break;
+  case 0xc3: // JMP
+  case 0xcb:
+    fprintf(out, "  return rom_exit(state, 0x%04x, %d);\n", imm16, *cycles);
+    break;
+  case 0xcd: // CALL
+  case 0xdd:
+  case 0xed:
+  case 0xfd:
+    fprintf(out, "  rom_push(state, 0x%04x);\n", next);
+    fprintf(out, "  return rom_exit(state, 0x%04x, %d);\n", imm16, *cycles);
+    break;
+  case 0xc9: // RET
+  case 0xd9:
+    fprintf(out, "  return rom_exit(state, rom_pop(state), %d);\n", *cycles);
+    break;
+  case 0xe9: // PCHL
+    fprintf(out, "  return rom_exit(state, state->hl, %d);\n", *cycles);
+    break;
+  }
+}
+
+static void emit(FILE *out, const char *name) {
+  int blocks = 0, insts = 0;
+  fprintf(out,
+          "// Generated by recompiler from %s, do not edit.\n"
+          "// Included by 8080em.c when built with -DSTATIC_ROM.\n\n"
+          "#define STATIC_ROM_SIZE %d\n\n",
+          name, rom_size);
+  // The ROM itself, so the emulator can tell it was handed the same one and
+  // check the blocks against its interpreter
+  fprintf(out, "static const uint8_t static_rom_image[STATIC_ROM_SIZE] = {");
+  for (int i = 0; i < rom_size; i++)
+    fprintf(out, "%s0x%02x,", i % 12 ? " " : "\n    ", rom[i]);
+  fprintf(out, "\n};\n\n");
+  fprintf(out,
+          "static inline int rom_push(State8080 *state, uint16_t value) {\n"
+          "  int stale = write_mem(state, state->sp - 1, value >> 8);\n"
+          "  stale |= write_mem(state, state->sp - 2, value & 0xff);\n"
+          "  state->sp -= 2;\n"
+          "  return stale;\n"
+          "}\n\n"
+          "static inline uint16_t rom_pop(State8080 *state) {\n"
+          "  uint16_t value = read_mem16(state, state->sp);\n"
+          "  state->sp += 2;\n"
+          "  return value;\n"
+          "}\n\n"
+          "static inline int rom_exit(State8080 *state, uint16_t pc, "
+          "int cycles) {\n"
+          "  state->pc = pc;\n"
+          "  return cycles;\n"
+          "}\n\n");
+
+  for (int start = 0; start < rom_size; start++) {
+    int n;
+    if (!is_block[start] || block_length(start, &n) == 0)
+      continue;
+    fprintf(out, "static int rom_%04x(State8080 *state) {\n", start);
+    int pc = start, cycles = 0;
+    for (int i = 0, p = start; i < n; i++, p += length8080[rom[p]]) {
+      if (stores(rom[p])) {
+        fprintf(out, "  int stale = 0; // a store overwrote translated code\n");
+        break;
+      }
+    }
+    for (int i = 0; i < n; i++) {
+      uint8_t op = rom[pc];
+      fprintf(out, "  // %04x %02x\n", pc, op);
+      emit_inst(out, pc, op, &cycles);
+      pc += length8080[op];
+      if (stores(op))
+        fprintf(out, "  if (stale)\n    return rom_exit(state, 0x%04x, %d);\n",
+                pc, cycles);
+    }
+    uint8_t last = 0;
+    for (int p = start; p < pc; p += length8080[rom[p]])
+      last = rom[p];
+    if (!block_end8080[last])
+      fprintf(out, "  return rom_exit(state, 0x%04x, %d);\n", pc, cycles);
+    fprintf(out, "}\n\n");
+    blocks++;
+    insts += n;
+  }
+
+  fprintf(out, "static int static_rom_matches(const uint8_t *memory) {\n"
+               "  return memcmp(memory, static_rom_image, STATIC_ROM_SIZE) == "
+               "0;\n"
+               "}\n\n");
+  fprintf(out, "// Entry points of the translated blocks\n"
+               "static const uint16_t static_rom_blocks[] = {");
+  for (int start = 0, i = 0; start < rom_size; start++) {
+    int n;
+    if (is_block[start] && block_length(start, &n) > 0)
+      fprintf(out, "%s0x%04x,", i++ % 8 ? " " : "\n    ", start);
+  }
+  fprintf(out, "\n};\n\n");
+  fprintf(out, "// Runs the translated block at state->pc, returns the cycles "
+               "it used or 0\n// if there is none\n"
+               "static int static_rom_block(State8080 *state) {\n"
+               "  switch (state->pc) {\n");
+  for (int start = 0; start < rom_size; start++) {
+    int n;
+    if (is_block[start] && block_length(start, &n) > 0)
+      fprintf(out, "  case 0x%04x:\n    return rom_%04x(state);\n", start,
+              start);
+  }
+  fprintf(out, "  }\n  return 0;\n}\n");
+  fprintf(stderr, "%s: %d blocks, %d instructions\n", name, blocks, insts);
+}
+
+// Check ROM (-t): a ROM that starts the way Space Invaders does, NOPs
+// and a jump at the reset vector, handlers at RST 1 and 2 that save the
+// registers, read a port and return with EI, and a setup call before a
+// main loop ending in HLT, then a loop polling RAM like the game's wait
+// loops. Every instruction reachable from the vectors
+// but the HLT must come out translated, and the C written for it is meant
+// for a STATIC_ROM build of 8080em to check with -s:
+//
+//	./recompiler -t > check.c
+//	cc -O2 -pthread -DSTATIC_ROM='"check.c"' -o 8080em-check 8080em.c
+//	./8080em-check -s
+static const uint8_t check_rom[0x80] = {
+    [0x00] = 0x00, 0x00, 0x00, 0xc3, 0x50, 0x00, // NOP NOP NOP JMP 0050
+    [0x08] = 0xf5, 0xc5, 0xd5, 0xe5, 0xc3, 0x30, 0x00, // PUSH x4, JMP 0030
+    [0x10] = 0xf5, 0xc5, 0xd5, 0xe5, 0xc3, 0x30, 0x00,
+    // IN 1; STA 2000; XTHL; XTHL; LDA 2000; ADI 1; DAA; OUT 3; POP x4;
+    // EI; RET
+    [0x30] = 0xdb, 0x01, 0x32, 0x00, 0x20, 0xe3, 0xe3, 0x3a, 0x00, 0x20,
+    0xc6, 0x01, 0x27, 0xd3, 0x03, 0xe1, 0xd1, 0xc1, 0xf1, 0xfb, 0xc9,
+    // LXI SP,2400; MVI B,0; CALL 0070; EI; 0059: MOV A,B; INR B; DCR B;
+    // ADD C; JNZ 0059; HLT; JMP 0064; 0064: LDA 20c0; ANA A; JZ 0064;
+    // JMP 0059
+    [0x50] = 0x31, 0x00, 0x24, 0x06, 0x00, 0xcd, 0x70, 0x00, 0xfb, 0x78,
+    0x04, 0x05, 0x81, 0xc2, 0x59, 0x00, 0x76, 0xc3, 0x64, 0x00, 0x3a, 0xc0,
+    0x20, 0xa7, 0xca, 0x64, 0x00, 0xc3, 0x59, 0x00,
+    // LXI H,2400; 0073: MVI M,0; INX H; MOV A,H; CPI 40; JNZ 0073; RET
+    [0x70] = 0x21, 0x00, 0x24, 0x36, 0x00, 0x23, 0x7c, 0xfe, 0x40, 0xc2,
+    0x73, 0x00, 0xc9};
+
+static int self_check(void) {
+  // Translates the check ROM, returns 0 if it came out as it should
+  rom_size = sizeof(check_rom);
+  rom = calloc(0x10000, 1);
+  memcpy(rom, check_rom, sizeof(check_rom));
+  find_blocks();
+  static uint8_t translated[0x10000], seen[0x10000];
+  for (int start = 0; start < rom_size; start++) {
+    int n;
+    if (!is_block[start])
+      continue;
+    block_length(start, &n);
+    for (int i = 0, pc = start; i < n; i++, pc += length8080[rom[pc]])
+      translated[pc] = 1;
+  }
+  // Walks the instructions direct control flow reaches, as find_blocks()
+  // should have
+  int stack[8 + 2 * sizeof(check_rom)], depth = 0, reached = 0, missed = 0;
+  for (int v = 0; v < 0x40; v += 8)
+    stack[depth++] = v;
+  while (depth > 0) {
+    int pc = stack[--depth];
+    if (pc >= rom_size || seen[pc])
+      continue;
+    seen[pc] = 1;
+    reached++;
+    uint8_t op = rom[pc];
+    if (op != 0x76 && !translated[pc]) {
+      fprintf(stderr, "not translated: %04x %02x\n", pc, op);
+      missed++;
+    }
+    if (falls_through(op))
+      stack[depth++] = pc + length8080[op];
+    if (has_target(op))
+      stack[depth++] = rom[pc + 1] | rom[pc + 2] << 8;
+    if ((op & 0xc7) == 0xc7)
+      stack[depth++] = op & 0x38;
+  }
+  fprintf(stderr, "self-check: %d instructions reached, %d not translated\n",
+          reached, missed);
+  if (missed != 0)
+    return 1;
+  emit(stdout, "the built-in check ROM");
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: %s <rom> > rom.c | -t > check.c\n", argv[0]);
+    exit(1);
+  }
+  if (argv[1][0] == '-' && argv[1][1] == 't')
+    return self_check();
+  FILE *f = fopen(argv[1], "rb");
+  if (f == NULL) {
+    printf("Error: could not open %s\n", argv[1]);
+    exit(1);
+  }
+  fseek(f, 0L, SEEK_END);
+  rom_size = ftell(f);
+  fseek(f, 0L, SEEK_SET);
+  if (rom_size > 0x10000)
+    rom_size = 0x10000; // the 8080 can only address 64K
+  rom = calloc(0x10000, 1);
+  fread(rom, rom_size, 1, f);
+  fclose(f);
+
+  find_blocks();
+  emit(stdout, argv[1]);
+  return 0;
+}
@@ -0,0 +1,414 @@
+// Space Invaders video, shared by 8080em.c and the tools that read its
+// output.
+//
+// The screen is 1 bit per pixel in RAM at 0x2400-0x3fff, stored with the
+// monitor turned on its side: each run of 32 bytes is one column of the
+// upright 224x256 picture, from its bottom pixel (bit 0 of the first byte)
+// to its top. Rendering first turns the bits upright into row bitmaps with
+// a bit-matrix transpose, then expands each row to pixels through an
+// optional per-pixel colour table, the cellophane overlay the cabinet had.
+//
+// Both steps have SIMD kernels, SSE2 and for the pixel expansion AVX2,
+// picked at compile time (-mavx2 for the latter), and plain C for other
+// hosts or with -DVIDEO_SCALAR.
+
+#ifndef VIDEO8080_H
+#define VIDEO8080_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(VIDEO_SCALAR) && (defined(__AVX2__) || defined(__SSE2__))
+#include <immintrin.h>
+#endif
+
+#define SCREEN_WIDTH 224
+#define SCREEN_HEIGHT 256
+#define SCREEN_ROW_BYTES (SCREEN_WIDTH / 8)
+#define VRAM_START 0x2400
+#define VRAM_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT / 8)
+
+// Pixel colour as bytes R, G, B, A in memory (on a little-endian host)
+#define RGBA(r, g, b) ((uint32_t)(r) | (g) << 8 | (b) << 16 | 0xffu << 24)
+#define VIDEO_BLACK RGBA(0, 0, 0)
+#define VIDEO_WHITE RGBA(0xff, 0xff, 0xff)
+
+// Upright picture as row bitmaps, top row first, the pixel at x in bit
+// x % 8 of byte x / 8
+typedef uint8_t ScreenRows[SCREEN_HEIGHT][SCREEN_ROW_BYTES];
+
+// Which 32-byte VRAM lines (columns of the upright picture) changed, one
+// bit each, line n in bit n % 64 of lines[n / 64]. Byte g of the bitmap
+// covers the 8 columns the renderer handles together, those are the bits
+// of the `groups` masks below.
+#define VRAM_LINE_BYTES 32
+#define VIDEO_ALL_GROUPS ((1u << SCREEN_ROW_BYTES) - 1)
+typedef struct VideoDirty {
+  uint64_t lines[SCREEN_WIDTH / 64 + 1];
+} VideoDirty;
+
+static inline void video_dirty_line(VideoDirty *dirty, uint16_t offset) {
+  // Notes a change at byte `offset` of VRAM
+  unsigned line = offset / VRAM_LINE_BYTES;
+  dirty->lines[line / 64] |= 1ull << (line % 64);
+}
+
+static inline uint32_t video_dirty_groups(const VideoDirty *dirty) {
+  // The groups with a changed line, 0 if the frame is the same as before
+  uint32_t groups = 0;
+  for (int i = 0; i < SCREEN_WIDTH / 64 + 1; i++) {
+    uint64_t word = dirty->lines[i];
+    for (int b = 0; word != 0; b++, word >>= 8)
+      if (word & 0xff)
+        groups |= 1u << (i * 8 + b);
+  }
+  return groups;
+}
+
+#if defined(VIDEO_SCALAR) || !(defined(__AVX2__) || defined(__SSE2__))
+#define VIDEO_KERNEL "scalar"
+#elif defined(__AVX2__)
+#define VIDEO_KERNEL "avx2"
+#else
+#define VIDEO_KERNEL "sse2"
+#endif
+
+#if !defined(VIDEO_SCALAR) && (defined(__AVX2__) || defined(__SSE2__))
+static inline void video_rows_group(const uint8_t *vram, ScreenRows rows,
+                                    int group, int from) {
+  // Columns group*8.. and VRAM byte offsets from..from+15. Byte-interleaving
+  // the 8 columns leaves 8-byte lanes holding one offset across them, then
+  // movemask lifts bit 7 of each byte out as a row of 8 pixels and adding
+  // each byte to itself brings the next bit up. AVX2 builds use this too,
+  // its in-lane unpacks made the 32-byte version slower.
+  const uint8_t *col = vram + group * 8 * 32 + from;
+  __m128i c[8];
+  for (int j = 0; j < 8; j++)
+    c[j] = _mm_loadu_si128((const __m128i *)(col + j * 32));
+  __m128i t0 = _mm_unpacklo_epi8(c[0], c[1]);
+  __m128i t1 = _mm_unpackhi_epi8(c[0], c[1]);
+  __m128i t2 = _mm_unpacklo_epi8(c[2], c[3]);
+  __m128i t3 = _mm_unpackhi_epi8(c[2], c[3]);
+  __m128i t4 = _mm_unpacklo_epi8(c[4], c[5]);
+  __m128i t5 = _mm_unpackhi_epi8(c[4], c[5]);
+  __m128i t6 = _mm_unpacklo_epi8(c[6], c[7]);
+  __m128i t7 = _mm_unpackhi_epi8(c[6], c[7]);
+  __m128i u0 = _mm_unpacklo_epi16(t0, t2), u1 = _mm_unpackhi_epi16(t0, t2);
+  __m128i u2 = _mm_unpacklo_epi16(t1, t3), u3 = _mm_unpackhi_epi16(t1, t3);
+  __m128i u4 = _mm_unpacklo_epi16(t4, t6), u5 = _mm_unpackhi_epi16(t4, t6);
+  __m128i u6 = _mm_unpacklo_epi16(t5, t7), u7 = _mm_unpackhi_epi16(t5, t7);
+  // v[k] holds offsets from+2k and from+2k+1
+  __m128i v[8] = {_mm_unpacklo_epi32(u0, u4), _mm_unpackhi_epi32(u0, u4),
+                  _mm_unpacklo_epi32(u1, u5), _mm_unpackhi_epi32(u1, u5),
+                  _mm_unpacklo_epi32(u2, u6), _mm_unpackhi_epi32(u2, u6),
+                  _mm_unpacklo_epi32(u3, u7), _mm_unpackhi_epi32(u3, u7)};
+  for (int k = 0; k < 8; k++) {
+    __m128i x = v[k];
+    int offset = from + 2 * k;
+    for (int bit = 7; bit >= 0; bit--) {
+      int m = _mm_movemask_epi8(x);
+      x = _mm_add_epi8(x, x);
+      rows[SCREEN_HEIGHT - 1 - (offset * 8 + bit)][group] = (uint8_t)m;
+      rows[SCREEN_HEIGHT - 1 - (offset * 8 + 8 + bit)][group] =
+          (uint8_t)(m >> 8);
+    }
+  }
+}
+#else
+static inline uint64_t video_transpose8(uint64_t x) {
+  // 8x8 bit matrix transpose, byte i bit j <-> byte j bit i
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaull;
+  x ^= t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000cccc0000ccccull;
+  x ^= t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ull;
+  x ^= t ^ (t << 28);
+  return x;
+}
+#endif
+
+static inline void video_rows(const uint8_t *vram, ScreenRows rows,
+                              uint32_t groups) {
+  // Turns the VRAM (from VRAM_START) upright into row bitmaps, only the
+  // bytes of `groups` (VIDEO_ALL_GROUPS for all) in each row
+  for (int group = 0; group < SCREEN_ROW_BYTES; group++) {
+    if (!(groups >> group & 1))
+      continue;
+#if !defined(VIDEO_SCALAR) && (defined(__AVX2__) || defined(__SSE2__))
+    video_rows_group(vram, rows, group, 0);
+    video_rows_group(vram, rows, group, 16);
+#else
+    const uint8_t *col = vram + group * 8 * 32;
+    for (int offset = 0; offset < 32; offset++) {
+      uint64_t x = 0;
+      for (int j = 0; j < 8; j++)
+        x |= (uint64_t)col[j * 32 + offset] << (8 * j);
+      x = video_transpose8(x);
+      for (int bit = 0; bit < 8; bit++)
+        rows[SCREEN_HEIGHT - 1 - (offset * 8 + bit)][group] =
+            (uint8_t)(x >> (8 * bit));
+    }
+#endif
+  }
+}
+
+static inline void video_rgba8(uint8_t m, const uint32_t *colors,
+                               uint32_t *px) {
+  // The 8 pixels of row byte `m`, lit ones from `colors` or white
+#if !defined(VIDEO_SCALAR) && defined(__AVX2__)
+  const __m256i sel = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  __m256i lit =
+      _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(m), sel), sel);
+  __m256i on = colors ? _mm256_loadu_si256((const __m256i *)colors)
+                      : _mm256_set1_epi32((int)VIDEO_WHITE);
+  _mm256_storeu_si256(
+      (__m256i *)px,
+      _mm256_blendv_epi8(_mm256_set1_epi32((int)VIDEO_BLACK), on, lit));
+#elif !defined(VIDEO_SCALAR) && defined(__SSE2__)
+  const __m128i black = _mm_set1_epi32((int)VIDEO_BLACK);
+  for (int half = 0; half < 2; half++) {
+    const __m128i sel =
+        half ? _mm_setr_epi32(16, 32, 64, 128) : _mm_setr_epi32(1, 2, 4, 8);
+    __m128i lit = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(m), sel), sel);
+    __m128i on = colors ? _mm_loadu_si128((const __m128i *)(colors + half * 4))
+                        : _mm_set1_epi32((int)VIDEO_WHITE);
+    _mm_storeu_si128((__m128i *)(px + half * 4),
+                     _mm_or_si128(_mm_and_si128(lit, on),
+                                  _mm_andnot_si128(lit, black)));
+  }
+#else
+  for (int b = 0; b < 8; b++) {
+    uint32_t lit = -(uint32_t)((m >> b) & 1);
+    uint32_t on = colors ? colors[b] : VIDEO_WHITE;
+    px[b] = (on & lit) | (VIDEO_BLACK & ~lit);
+  }
+#endif
+}
+
+static inline void video_rgba(const ScreenRows rows,
+                              const uint32_t *overlay, uint32_t groups,
+                              uint32_t *out) {
+  // Lit pixels take their colour from `overlay` (SCREEN_WIDTH *
+  // SCREEN_HEIGHT entries, NULL for white), dark ones are black. Only the
+  // columns of `groups` are written: whole frames row by row, in memory
+  // order, a few changed groups one at a time down the screen, which
+  // costs far less than testing each group on every row.
+  if (groups == VIDEO_ALL_GROUPS) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+      for (int i = 0; i < SCREEN_ROW_BYTES; i++) {
+        int at = y * SCREEN_WIDTH + i * 8;
+        video_rgba8(rows[y][i], overlay ? overlay + at : NULL, out + at);
+      }
+    return;
+  }
+  for (int i = 0; i < SCREEN_ROW_BYTES; i++) {
+    if (!(groups >> i & 1))
+      continue;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+      int at = y * SCREEN_WIDTH + i * 8;
+      video_rgba8(rows[y][i], overlay ? overlay + at : NULL, out + at);
+    }
+  }
+}
+
+static inline void video_gray16(const uint8_t *m, const uint8_t *levels,
+                                uint8_t *px) {
+  // The 16 pixels of row bytes m[0] and m[1], lit ones from `levels` or
+  // 0xff
+#if !defined(VIDEO_SCALAR) && (defined(__AVX2__) || defined(__SSE2__))
+  // Spread each byte over 8 lanes and test a bit in each
+  const __m128i sel = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8,
+                                    16, 32, 64, -128);
+  __m128i x = _mm_cvtsi32_si128(m[0] | m[1] << 8);
+  x = _mm_unpacklo_epi8(x, x);
+  x = _mm_unpacklo_epi16(x, x);
+  x = _mm_unpacklo_epi32(x, x);
+  __m128i lit = _mm_cmpeq_epi8(_mm_and_si128(x, sel), sel);
+  __m128i on = levels ? _mm_loadu_si128((const __m128i *)levels)
+                      : _mm_set1_epi8(-1);
+  _mm_storeu_si128((__m128i *)px, _mm_and_si128(lit, on));
+#else
+  for (int b = 0; b < 16; b++) {
+    uint8_t lit = -((m[b / 8] >> (b % 8)) & 1);
+    px[b] = lit & (levels ? levels[b] : 0xff);
+  }
+#endif
+}
+
+static inline void video_gray(const ScreenRows rows,
+                              const uint8_t *overlay, uint32_t groups,
+                              uint8_t *out) {
+  // One byte a pixel: lit ones take their value from `overlay` (NULL for
+  // 0xff), dark ones are 0. As video_rgba(), but groups go in pairs, so a
+  // changed group's neighbour is written too.
+  if (groups == VIDEO_ALL_GROUPS) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+      for (int i = 0; i < SCREEN_ROW_BYTES; i += 2) {
+        int at = y * SCREEN_WIDTH + i * 8;
+        video_gray16(rows[y] + i, overlay ? overlay + at : NULL, out + at);
+      }
+    return;
+  }
+  for (int i = 0; i < SCREEN_ROW_BYTES; i += 2) {
+    if (!(groups >> i & 3))
+      continue;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+      int at = y * SCREEN_WIDTH + i * 8;
+      video_gray16(rows[y] + i, overlay ? overlay + at : NULL, out + at);
+    }
+  }
+}
+
+static inline void video_overlay_invaders(uint32_t *rgba, uint8_t *gray) {
+  // The cabinet's overlay: red over the flying saucer, green over the
+  // shields and player and the reserve ships under them, white elsewhere.
+  // Either table may be NULL.
+  for (int y = 0; y < SCREEN_HEIGHT; y++) {
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+      uint32_t c = VIDEO_WHITE;
+      if (y >= 32 && y < 64)
+        c = RGBA(0xff, 0x20, 0x20);
+      else if ((y >= 184 && y < 240) || (y >= 240 && x >= 16 && x < 134))
+        c = RGBA(0x20, 0xff, 0x20);
+      if (rgba != NULL)
+        rgba[y * SCREEN_WIDTH + x] = c;
+      if (gray != NULL) // BT.601 luma
+        gray[y * SCREEN_WIDTH + x] = (uint8_t)(
+            ((c & 0xff) * 77 + (c >> 8 & 0xff) * 150 + (c >> 16 & 0xff) * 29) >>
+            8);
+    }
+  }
+}
+
+// Frame streams, as 8080em -c writes them and videodec expands recordings
+// into. Y4M is mono, one byte a pixel from video_gray(); PPM frames are
+// concatenated, from video_rgba() with the alpha dropped. `rgb` is
+// SCREEN_WIDTH * SCREEN_HEIGHT * 3 bytes of scratch. They return 0 on a
+// write error.
+static inline int video_write_y4m_header(FILE *out) {
+  return fprintf(out, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n",
+                 SCREEN_WIDTH, SCREEN_HEIGHT) > 0;
+}
+
+static inline int video_write_y4m(FILE *out, const uint8_t *gray) {
+  fputs("FRAME\n", out);
+  return fwrite(gray, SCREEN_WIDTH * SCREEN_HEIGHT, 1, out) == 1;
+}
+
+static inline int video_write_ppm(FILE *out, const uint32_t *rgba,
+                                  uint8_t *rgb) {
+  for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+    memcpy(rgb + i * 3, rgba + i, 3);
+  fprintf(out, "P6\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+  return fwrite(rgb, SCREEN_WIDTH * SCREEN_HEIGHT * 3, 1, out) == 1;
+}
+
+// Recordings (8080em -c name.v80) keep the 1bpp VRAM of each frame, most
+// of them as the XOR with the frame before, which is nearly all zeros:
+//
+//	header   "V80R", version, VRAM size (u16)
+//	records  type, frame number (u32), payload length (u32), payload
+//
+// Numbers are little-endian. A VIDEO_RECORD_KEY payload is the whole VRAM
+// and a VIDEO_RECORD_DELTA one its XOR with the last record's frame, both
+// through video_rle_encode(). Frame numbers only go up, a frame left out
+// looks like the one before it. A key record comes at least every
+// VIDEO_KEY_INTERVAL frames for readers to start from, and the file ends
+// with a VIDEO_RECORD_END record carrying the number of frames run.
+#define VIDEO_RECORD_MAGIC "V80R"
+#define VIDEO_RECORD_VERSION 1
+#define VIDEO_RECORD_HEADER 7
+#define VIDEO_RECORD_KEY 'K'
+#define VIDEO_RECORD_DELTA 'D'
+#define VIDEO_RECORD_END 'E'
+#define VIDEO_RECORD_HEAD 9 // bytes before a record's payload
+#define VIDEO_KEY_INTERVAL 60
+// Room video_rle_encode() may need for `n` bytes
+#define VIDEO_RLE_BOUND(n) ((n) + (n) / 32 + 8)
+
+static inline size_t video_rle_count(uint8_t *out, size_t count) {
+  // LEB128, 7 bits a byte, low first
+  size_t o = 0;
+  for (; count >= 0x80; count >>= 7)
+    out[o++] = (uint8_t)(count | 0x80);
+  out[o++] = (uint8_t)count;
+  return o;
+}
+
+static inline size_t video_rle_encode(const uint8_t *in, size_t n,
+                                      uint8_t *out) {
+  // Runs of 3 or more equal bytes become count * 2 + 1 and the byte, what
+  // is between them count * 2 and the bytes as they are. Returns the
+  // encoded length.
+  size_t o = 0, literal = 0, i = 0;
+  while (i < n) {
+    size_t run = 1;
+    while (i + run < n && in[i + run] == in[i])
+      run++;
+    if (run < 3) {
+      i += run;
+      continue;
+    }
+    if (i > literal) {
+      o += video_rle_count(out + o, (i - literal) * 2);
+      memcpy(out + o, in + literal, i - literal);
+      o += i - literal;
+    }
+    o += video_rle_count(out + o, run * 2 + 1);
+    out[o++] = in[i];
+    i += run;
+    literal = i;
+  }
+  if (n > literal) {
+    o += video_rle_count(out + o, (n - literal) * 2);
+    memcpy(out + o, in + literal, n - literal);
+    o += n - literal;
+  }
+  return o;
+}
+
+static inline int video_rle_decode(const uint8_t *in, size_t len,
+                                   uint8_t *out, size_t n) {
+  // Undoes video_rle_encode(), returns 0 unless `in` is well formed and
+  // comes to exactly `n` bytes
+  size_t i = 0, o = 0;
+  while (i < len) {
+    size_t token = 0;
+    for (int shift = 0;; shift += 7) {
+      if (i == len || shift > 28)
+        return 0;
+      uint8_t b = in[i++];
+      token |= (size_t)(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        break;
+    }
+    size_t count = token >> 1;
+    if (count > n - o)
+      return 0;
+    if (token & 1) {
+      if (i == len)
+        return 0;
+      memset(out + o, in[i++], count);
+    } else {
+      if (count > len - i)
+        return 0;
+      memcpy(out + o, in + i, count);
+      i += count;
+    }
+    o += count;
+  }
+  return o == n;
+}
+
+static inline void video_put32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline uint32_t video_get32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+#endif
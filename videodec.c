@@ -0,0 +1,153 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "video8080.h"
+
+// Recording decoder: expands a recording made with `8080em <rom> -c
+// name.v80` into the Y4M or PPM stream -c would have written, frames the
+// recording left out repeated from the one before.
+//
+//	./videodec game.v80 game.y4m [first [count]]
+//
+// Output starts at frame `first`. Decoding starts at the last key record
+// at or before it, the records before that are only stepped over.
+
+typedef struct Output {
+  FILE *out;
+  int y4m;
+  ScreenRows rows;
+  uint32_t rgba[SCREEN_WIDTH * SCREEN_HEIGHT];
+  uint32_t rgba_overlay[SCREEN_WIDTH * SCREEN_HEIGHT];
+  uint8_t gray[SCREEN_WIDTH * SCREEN_HEIGHT];
+  uint8_t gray_overlay[SCREEN_WIDTH * SCREEN_HEIGHT];
+  uint8_t rgb[SCREEN_WIDTH * SCREEN_HEIGHT * 3];
+  long frames;
+} Output;
+
+static void fail(const char *what, long at) {
+  printf("Error: %s at byte %ld\n", what, at);
+  exit(1);
+}
+
+static void emit(Output *o, const uint8_t *vram) {
+  // Renders the whole screen again, frames here come at most once each
+  video_rows(vram, o->rows, VIDEO_ALL_GROUPS);
+  const uint8_t(*rows)[SCREEN_ROW_BYTES] = o->rows;
+  int ok;
+  if (o->y4m) {
+    video_gray(rows, o->gray_overlay, VIDEO_ALL_GROUPS, o->gray);
+    ok = video_write_y4m(o->out, o->gray);
+  } else {
+    video_rgba(rows, o->rgba_overlay, VIDEO_ALL_GROUPS, o->rgba);
+    ok = video_write_ppm(o->out, o->rgba, o->rgb);
+  }
+  if (!ok) {
+    printf("Error: could not write a frame\n");
+    exit(1);
+  }
+  o->frames++;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    printf("Usage: %s <recording.v80> <out.y4m|out.ppm> [first [count]]\n",
+           argv[0]);
+    exit(1);
+  }
+  FILE *f = fopen(argv[1], "rb");
+  if (f == NULL) {
+    printf("Error: could not open %s\n", argv[1]);
+    exit(1);
+  }
+  fseek(f, 0L, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0L, SEEK_SET);
+  uint8_t *data = malloc(size > 0 ? size : 1);
+  if (fread(data, 1, size, f) != (size_t)size)
+    fail("short read", 0);
+  fclose(f);
+  if (size < VIDEO_RECORD_HEADER ||
+      memcmp(data, VIDEO_RECORD_MAGIC, 4) != 0 ||
+      data[4] != VIDEO_RECORD_VERSION ||
+      (data[5] | data[6] << 8) != VRAM_SIZE)
+    fail("not a recording of this version", 0);
+
+  uint32_t first = argc > 3 ? strtoul(argv[3], NULL, 0) : 0;
+  uint32_t stop = UINT32_MAX; // one past the last frame to write
+  if (argc > 4)
+    stop = first + strtoul(argv[4], NULL, 0);
+
+  // Find the key record to decode from, reading only record heads
+  long start = -1;
+  for (long at = VIDEO_RECORD_HEADER; at + VIDEO_RECORD_HEAD <= size;) {
+    uint32_t number = video_get32(data + at + 1);
+    if (data[at] == VIDEO_RECORD_END || number > first)
+      break;
+    if (data[at] == VIDEO_RECORD_KEY)
+      start = at;
+    at += VIDEO_RECORD_HEAD + video_get32(data + at + 5);
+  }
+  if (start < 0)
+    start = VIDEO_RECORD_HEADER; // nothing to skip to, or no frames
+
+  Output *o = calloc(1, sizeof(Output));
+  size_t len = strlen(argv[2]);
+  o->y4m = len >= 4 && strcmp(argv[2] + len - 4, ".y4m") == 0;
+  o->out = fopen(argv[2], "wb");
+  if (o->out == NULL) {
+    printf("Error: could not open %s\n", argv[2]);
+    exit(1);
+  }
+  video_overlay_invaders(o->rgba_overlay, o->gray_overlay);
+  if (o->y4m)
+    video_write_y4m_header(o->out);
+
+  // Each record's frame shows until the next record's
+  static uint8_t vram[VRAM_SIZE], delta[VRAM_SIZE];
+  int have = 0;
+  uint32_t next = first, end = 0, last = 0;
+  long at = start;
+  while (at + VIDEO_RECORD_HEAD <= size) {
+    uint8_t type = data[at];
+    uint32_t number = video_get32(data + at + 1);
+    uint32_t length = video_get32(data + at + 5);
+    const uint8_t *payload = data + at + VIDEO_RECORD_HEAD;
+    if (type == VIDEO_RECORD_END) {
+      end = number;
+      break;
+    }
+    if (length > (uint64_t)size - at - VIDEO_RECORD_HEAD)
+      fail("truncated record", at);
+    if (have && number <= last)
+      fail("frame numbers go back", at);
+    for (; have && next < number && next < stop; next++)
+      emit(o, vram);
+    if (type == VIDEO_RECORD_KEY) {
+      if (!video_rle_decode(payload, length, vram, VRAM_SIZE))
+        fail("bad key record", at);
+    } else if (type == VIDEO_RECORD_DELTA && have) {
+      if (!video_rle_decode(payload, length, delta, VRAM_SIZE))
+        fail("bad delta record", at);
+      for (int i = 0; i < VRAM_SIZE; i++)
+        vram[i] ^= delta[i];
+    } else {
+      fail(type == VIDEO_RECORD_DELTA ? "delta before any key record"
+                                      : "unknown record",
+           at);
+    }
+    have = 1;
+    last = number;
+    end = number + 1; // until an end record says more
+    at += VIDEO_RECORD_HEAD + length;
+  }
+  for (; have && next < end && next < stop; next++)
+    emit(o, vram);
+  if (fclose(o->out) != 0) {
+    printf("Error: could not write %s\n", argv[2]);
+    exit(1);
+  }
+  printf("%ld frames\n", o->frames);
+  return 0;
+}